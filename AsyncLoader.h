@@ -0,0 +1,322 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <iostream>
+
+#include "ThreadPool.h"
+#include "GEMModelView.h"
+
+// Coroutines that wait on each other. A Task does not run until it is awaited or start()ed;
+// awaiting it resumes the awaiting coroutine on whichever thread the task finished on.
+struct TaskPromiseBase
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+	bool detached = false;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept
+		{
+			return false;
+		}
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			TaskPromiseBase& promise = handle.promise();
+			if (promise.continuation)
+			{
+				return promise.continuation;
+			}
+			if (promise.detached)
+			{
+				// Nobody is left to rethrow to
+				if (promise.exception)
+				{
+					try
+					{
+						std::rethrow_exception(promise.exception);
+					}
+					catch (const std::exception& e)
+					{
+						std::cout << "Async task failed: " << e.what() << std::endl;
+					}
+					catch (...)
+					{
+						std::cout << "Async task failed." << std::endl;
+					}
+				}
+				handle.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() noexcept
+		{
+		}
+	};
+
+	std::suspend_always initial_suspend() noexcept
+	{
+		return {};
+	}
+	FinalAwaiter final_suspend() noexcept
+	{
+		return {};
+	}
+	void unhandled_exception()
+	{
+		exception = std::current_exception();
+	}
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase
+{
+	std::optional<T> value;
+
+	void return_value(T result)
+	{
+		value = std::move(result);
+	}
+	T result()
+	{
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+		return std::move(*value);
+	}
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase
+{
+	void return_void()
+	{
+	}
+	void result()
+	{
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+	}
+};
+
+template<typename T = void>
+class Task
+{
+public:
+	struct promise_type : TaskPromise<T>
+	{
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+	};
+
+	Task() = default;
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr))
+	{
+	}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (handle)
+			{
+				handle.destroy();
+			}
+			handle = std::exchange(other.handle, nullptr);
+		}
+		return *this;
+	}
+	~Task()
+	{
+		if (handle)
+		{
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	T await_resume()
+	{
+		return handle.promise().result();
+	}
+
+	// Runs the task on the calling thread until its first suspension and lets it free itself
+	// when it finishes. Exceptions it does not catch are printed.
+	void start()
+	{
+		std::coroutine_handle<promise_type> h = std::exchange(handle, nullptr);
+		h.promise().detached = true;
+		h.resume();
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	explicit Task(std::coroutine_handle<promise_type> h) : handle(h)
+	{
+	}
+};
+
+// Coroutines waiting to continue on the main thread, e.g. to create D3D11 resources after
+// a background load. The frame loop calls runPending() once per frame.
+class MainThreadQueue
+{
+public:
+	void post(std::coroutine_handle<> handle)
+	{
+		// Notify under the lock: once the main thread sees the handle it may finish and
+		// destroy the queue
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(handle);
+		posted.notify_one();
+	}
+
+	// Resumes everything posted before the call and returns how many were resumed.
+	// Coroutines posted while these run wait for the next call.
+	unsigned int runPending()
+	{
+		std::deque<std::coroutine_handle<>> ready;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.swap(pending);
+		}
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			ready[i].resume();
+		}
+		return static_cast<unsigned int>(ready.size());
+	}
+
+	// For tools and loading screens with nothing else to do: blocks until work arrives
+	unsigned int waitAndRunPending()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			posted.wait(lock, [this]() { return !pending.empty(); });
+		}
+		return runPending();
+	}
+
+	// co_await mainThread.resumeOnMainThread() moves the rest of a coroutine to the main thread
+	auto resumeOnMainThread()
+	{
+		struct Awaiter
+		{
+			MainThreadQueue* queue;
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+			void await_suspend(std::coroutine_handle<> handle)
+			{
+				queue->post(handle);
+			}
+			void await_resume() const noexcept
+			{
+			}
+		};
+		return Awaiter{ this };
+	}
+
+private:
+	std::deque<std::coroutine_handle<>> pending;
+	std::mutex mutex;
+	std::condition_variable posted;
+};
+
+// Loads GEM models on an I/O thread pool and continues the awaiting coroutine on the main
+// thread, so device uploads can follow the co_await directly:
+//   std::vector<GEMLoader::GEMMesh> meshes = co_await loader.loadAsync("bunny.gem");
+// Errors (missing, truncated or invalid files) are rethrown from the co_await.
+class AsyncModelLoader
+{
+public:
+	ThreadPool* ioPool = nullptr;
+	MainThreadQueue* mainThread = nullptr;
+
+	void init(ThreadPool* pool, MainThreadQueue* queue)
+	{
+		ioPool = pool;
+		mainThread = queue;
+	}
+
+	struct LoadOperation
+	{
+		AsyncModelLoader* loader;
+		std::string filename;
+		std::vector<GEMLoader::GEMMesh> meshes;
+		std::exception_ptr error;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			// The operation lives in the suspended coroutine's frame until it is resumed
+			loader->ioPool->submit([this, handle]()
+			{
+				try
+				{
+					meshes = load(filename);
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+				loader->mainThread->post(handle);
+			});
+		}
+		std::vector<GEMLoader::GEMMesh> await_resume()
+		{
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+			return std::move(meshes);
+		}
+	};
+
+	LoadOperation loadAsync(const std::string& filename)
+	{
+		return LoadOperation{ this, filename, {}, nullptr };
+	}
+
+	// Blocking load used by the I/O threads. Goes through GEMModelView, which validates the
+	// file and throws instead of exiting like GEMModelLoader does on a bad file.
+	static std::vector<GEMLoader::GEMMesh> load(const std::string& filename)
+	{
+		GEMLoader::GEMModelView view;
+		view.open(filename);
+		std::vector<GEMLoader::GEMMesh> meshes;
+		meshes.reserve(view.meshes.size());
+		for (size_t i = 0; i < view.meshes.size(); i++)
+		{
+			meshes.push_back(view.meshes[i].toMesh());
+		}
+		return meshes;
+	}
+};
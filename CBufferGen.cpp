@@ -0,0 +1,40 @@
+#include "ConstantBufferParser.h"
+#include <iostream>
+#include <fstream>
+#include <set>
+
+// Generates C++ structs and offset tables for every cbuffer in the given shader files:
+// CBufferGen ConstantBuffers.h VStri.txt PStri.txt
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cout << "Usage: CBufferGen <output header> <shader file>..." << std::endl;
+        return 1;
+    }
+
+    ConstantBufferParser parser;
+    std::vector<ParsedConstantBuffer> buffers;
+    std::set<std::string> names;
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::vector<ParsedConstantBuffer> parsed = parser.parseFile(argv[i]);
+            for (const auto& cb : parsed) {
+                // 多个着色器共享的常量缓冲区只生成一次
+                if (names.insert(cb.name).second) {
+                    buffers.push_back(cb);
+                }
+            }
+        }
+
+        std::ofstream out(argv[1]);
+        if (!out.is_open()) {
+            std::cout << "Failed to open " << argv[1] << std::endl;
+            return 1;
+        }
+        out << parser.generateHeader(buffers);
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+
+// Compile-time description of C++ structs that mirror HLSL cbuffers. Kept free of D3D so
+// headers generated by ConstantBufferParser can be included anywhere.
+
+// Layout of one member of a C++ struct that mirrors an HLSL cbuffer
+struct ConstantBufferField
+{
+	const char* name;
+	unsigned int offset;
+	unsigned int size;
+	// Outermost array dimension, elementCount is 0 for a field that is not an array
+	unsigned int elementSize = 0;
+	unsigned int elementCount = 0;
+};
+
+// HLSL packs variables into 16-byte registers and never lets one straddle a register boundary.
+// Every element of an HLSL array starts a new register, so a C++ array only matches when its
+// elements are whole registers: float4 a[2] is float a[2][4], and float a[4] (52 bytes in HLSL)
+// has to be written float a[4][4].
+constexpr bool isHLSLPacked(unsigned int offset, unsigned int size, unsigned int elementSize = 0, unsigned int elementCount = 0)
+{
+	if (elementCount > 0 && elementSize % 16 != 0)
+	{
+		return false;
+	}
+	return (offset % 16 == 0) || ((offset % 16) + size <= 16);
+}
+
+// HLSL only pads array elements up to the register, so the last one may be shorter
+constexpr bool matchesHLSLSize(const ConstantBufferField& field, unsigned int hlslSize)
+{
+	if (field.elementCount == 0)
+	{
+		return hlslSize == field.size;
+	}
+	return hlslSize > (field.elementCount - 1) * field.elementSize && hlslSize <= field.elementCount * field.elementSize;
+}
+
+template<size_t N>
+constexpr bool isHLSLPacked(const ConstantBufferField (&fields)[N])
+{
+	for (size_t i = 0; i < N; i++)
+	{
+		if (!isHLSLPacked(fields[i].offset, fields[i].size, fields[i].elementSize, fields[i].elementCount))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Specialised by CONSTANT_BUFFER_LAYOUT for each struct used with TypedConstantBuffer
+template<typename T>
+struct ConstantBufferLayout;
+
+template<typename T>
+struct ConstantBufferFieldShape
+{
+	static constexpr unsigned int elementSize = 0;
+	static constexpr unsigned int elementCount = 0;
+};
+
+template<typename T, size_t N>
+struct ConstantBufferFieldShape<T[N]>
+{
+	static constexpr unsigned int elementSize = static_cast<unsigned int>(sizeof(T));
+	static constexpr unsigned int elementCount = static_cast<unsigned int>(N);
+};
+
+#define CONSTANT_BUFFER_FIELD(Type, field) ConstantBufferField{ #field, static_cast<unsigned int>(offsetof(Type, field)), static_cast<unsigned int>(sizeof(((Type*)nullptr)->field)), \
+	ConstantBufferFieldShape<decltype(Type::field)>::elementSize, ConstantBufferFieldShape<decltype(Type::field)>::elementCount }
+
+// Describes a struct's fields and checks them against HLSL packing at compile time:
+// CONSTANT_BUFFER_LAYOUT(MatrixBuffer, CONSTANT_BUFFER_FIELD(MatrixBuffer, world), CONSTANT_BUFFER_FIELD(MatrixBuffer, view));
+#define CONSTANT_BUFFER_LAYOUT(Type, ...) \
+	template<> struct ConstantBufferLayout<Type> \
+	{ \
+		static constexpr ConstantBufferField fields[] = { __VA_ARGS__ }; \
+		static constexpr unsigned int count = sizeof(fields) / sizeof(fields[0]); \
+	}; \
+	static_assert(isHLSLPacked(ConstantBufferLayout<Type>::fields), #Type " does not follow HLSL constant buffer packing rules")
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+// Reads cbuffer declarations straight from HLSL source and lays them out with the HLSL
+// packing rules, giving the same offsets and sizes as D3DReflect without needing D3D.
+
+struct ParsedConstantBufferVariable
+{
+	std::string name;
+	std::string type;
+	unsigned int rows;     // 1 for scalars and vectors
+	unsigned int columns;  // vector width, or matrix columns
+	unsigned int elements; // 0 when not an array
+	bool matrix;           // floatRxC or matrix, including 1xN and Nx1
+	bool rowMajor;
+	unsigned int offset;
+	unsigned int size;
+};
+
+struct ParsedConstantBuffer
+{
+	std::string name;
+	int registerIndex; // -1 when the shader does not give register(bN)
+	unsigned int size;
+	std::vector<ParsedConstantBufferVariable> variables;
+};
+
+class ConstantBufferParser
+{
+public:
+	std::vector<ParsedConstantBuffer> parse(const std::string& hlsl)
+	{
+		tokens.clear();
+		position = 0;
+		tokenize(hlsl);
+		std::vector<ParsedConstantBuffer> buffers;
+		while (position < tokens.size())
+		{
+			if (tokens[position] == "cbuffer")
+			{
+				position++;
+				buffers.push_back(parseConstantBuffer());
+			} else
+			{
+				position++;
+			}
+		}
+		return buffers;
+	}
+
+	std::vector<ParsedConstantBuffer> parseFile(const std::string& filename)
+	{
+		std::ifstream file(filename);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open shader file: " + filename);
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		return parse(buffer.str());
+	}
+
+	// Writes a header with one struct per cbuffer, padded so every member sits at its HLSL
+	// offset, plus a CONSTANT_BUFFER_LAYOUT table for TypedConstantBuffer
+	std::string generateHeader(const std::vector<ParsedConstantBuffer>& buffers)
+	{
+		std::stringstream out;
+		out << "// Generated from HLSL cbuffer declarations, do not edit\n";
+		out << "#pragma once\n\n";
+		out << "#include <cstddef>\n";
+		out << "#include \"ConstantBufferLayout.h\"\n";
+		for (size_t b = 0; b < buffers.size(); b++)
+		{
+			const ParsedConstantBuffer& cb = buffers[b];
+			out << "\nstruct " << cb.name << "\n{\n";
+			unsigned int cursor = 0;
+			int padding = 0;
+			for (size_t i = 0; i < cb.variables.size(); i++)
+			{
+				const ParsedConstantBufferVariable& var = cb.variables[i];
+				if (var.offset > cursor)
+				{
+					out << "\tunsigned char _pad" << padding++ << "[" << (var.offset - cursor) << "];\n";
+				}
+				unsigned int cppSize = 0;
+				out << "\t" << cppDeclaration(var, cppSize) << ";\n";
+				cursor = var.offset + cppSize;
+				if (i + 1 < cb.variables.size() && cursor > cb.variables[i + 1].offset)
+				{
+					throw std::runtime_error("Variable " + var.name + " in " + cb.name + " shares its last register with the next variable and cannot be mirrored by a C++ struct.");
+				}
+			}
+			if (cb.size > cursor)
+			{
+				out << "\tunsigned char _pad" << padding++ << "[" << (cb.size - cursor) << "];\n";
+			}
+			out << "};\n";
+			out << "static_assert(sizeof(" << cb.name << ") == " << cb.size << ", \"" << cb.name << " size does not match HLSL\");\n";
+			for (size_t i = 0; i < cb.variables.size(); i++)
+			{
+				out << "static_assert(offsetof(" << cb.name << ", " << cb.variables[i].name << ") == " << cb.variables[i].offset << ", \"" << cb.name << "::" << cb.variables[i].name << " offset does not match HLSL\");\n";
+			}
+			out << "CONSTANT_BUFFER_LAYOUT(" << cb.name;
+			for (size_t i = 0; i < cb.variables.size(); i++)
+			{
+				const ParsedConstantBufferVariable& var = cb.variables[i];
+				out << ",\n\tConstantBufferField{ \"" << var.name << "\", " << var.offset << ", " << var.size;
+				if (var.elements > 0)
+				{
+					// cppDeclaration gives every element whole registers
+					out << ", " << registerCount(var) * 16 << ", " << var.elements;
+				}
+				out << " }";
+			}
+			out << ");\n";
+		}
+		return out.str();
+	}
+
+private:
+	std::vector<std::string> tokens;
+	size_t position = 0;
+
+	void tokenize(const std::string& source)
+	{
+		size_t i = 0;
+		while (i < source.size())
+		{
+			char c = source[i];
+			if (isspace(static_cast<unsigned char>(c)))
+			{
+				i++;
+			} else if (c == '/' && i + 1 < source.size() && source[i + 1] == '/')
+			{
+				while (i < source.size() && source[i] != '\n')
+				{
+					i++;
+				}
+			} else if (c == '/' && i + 1 < source.size() && source[i + 1] == '*')
+			{
+				size_t end = source.find("*/", i + 2);
+				i = (end == std::string::npos) ? source.size() : end + 2;
+			} else if (c == '#')
+			{
+				// Preprocessor lines are skipped, including continuations
+				while (i < source.size() && source[i] != '\n')
+				{
+					if (source[i] == '\\' && i + 1 < source.size() && source[i + 1] == '\n')
+					{
+						i++;
+					}
+					i++;
+				}
+			} else if (isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.')
+			{
+				size_t start = i;
+				while (i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_' || source[i] == '.'))
+				{
+					i++;
+				}
+				tokens.push_back(source.substr(start, i - start));
+			} else
+			{
+				tokens.push_back(std::string(1, c));
+				i++;
+			}
+		}
+	}
+
+	const std::string& peek()
+	{
+		static const std::string end;
+		return position < tokens.size() ? tokens[position] : end;
+	}
+
+	std::string next()
+	{
+		if (position >= tokens.size())
+		{
+			throw std::runtime_error("Unexpected end of HLSL source in cbuffer declaration.");
+		}
+		return tokens[position++];
+	}
+
+	void expect(const std::string& token)
+	{
+		std::string t = next();
+		if (t != token)
+		{
+			throw std::runtime_error("Expected '" + token + "' but found '" + t + "' in cbuffer declaration.");
+		}
+	}
+
+	ParsedConstantBuffer parseConstantBuffer()
+	{
+		ParsedConstantBuffer cb;
+		cb.name = next();
+		cb.registerIndex = -1;
+		cb.size = 0;
+		if (peek() == ":")
+		{
+			// register(bN)
+			next();
+			expect("register");
+			expect("(");
+			std::string reg = next();
+			if (reg.size() > 1 && (reg[0] == 'b' || reg[0] == 'B'))
+			{
+				cb.registerIndex = std::stoi(reg.substr(1));
+			}
+			expect(")");
+		}
+		expect("{");
+		unsigned int offset = 0;
+		unsigned int end = 0;
+		while (peek() != "}")
+		{
+			ParsedConstantBufferVariable var = parseVariable();
+			unsigned int start = var.offset;
+			if (start == 0xFFFFFFFF)
+			{
+				start = offset;
+				// Arrays and matrices start a new register, except row_major 1xN which packs like a vector
+				bool register16 = var.elements > 0 || (var.matrix && !(var.rowMajor && var.rows == 1));
+				if (register16 || ((start % 16) + var.size > 16))
+				{
+					start = (start + 15) & ~15u;
+				}
+			}
+			var.offset = start;
+			offset = start + var.size;
+			if (var.elements > 0)
+			{
+				// The next variable does not pack into the last element of an array
+				offset = (offset + 15) & ~15u;
+			}
+			end = (std::max)(end, offset);
+			cb.variables.push_back(var);
+		}
+		expect("}");
+		if (peek() == ";")
+		{
+			next();
+		}
+		cb.size = (end + 15) & ~15u;
+		return cb;
+	}
+
+	ParsedConstantBufferVariable parseVariable()
+	{
+		ParsedConstantBufferVariable var;
+		var.matrix = false;
+		var.rowMajor = false;
+		var.elements = 0;
+		var.offset = 0xFFFFFFFF;
+		std::string type = next();
+		while (type == "row_major" || type == "column_major" || type == "uniform" || type == "const" || type == "static" || type == "precise")
+		{
+			if (type == "row_major")
+			{
+				var.rowMajor = true;
+			}
+			type = next();
+		}
+		if (type == "struct")
+		{
+			throw std::runtime_error("Structs inside cbuffers are not supported by the cbuffer parser.");
+		}
+		parseType(type, var);
+		var.name = next();
+		if (peek() == "[")
+		{
+			next();
+			var.elements = std::stoi(next());
+			expect("]");
+		}
+		if (peek() == ":")
+		{
+			// packoffset(cN.x)
+			next();
+			expect("packoffset");
+			expect("(");
+			std::string reg = next();
+			size_t dot = reg.find('.');
+			unsigned int component = 0;
+			if (dot != std::string::npos)
+			{
+				component = std::string("xyzw").find(reg[dot + 1]);
+				reg = reg.substr(0, dot);
+			}
+			var.offset = std::stoi(reg.substr(1)) * 16 + component * 4;
+			expect(")");
+		}
+		if (peek() == "=")
+		{
+			while (peek() != ";")
+			{
+				next();
+			}
+		}
+		expect(";");
+		// Size as reported by reflection: every register is padded to 16 bytes except the last
+		unsigned int registers = registerCount(var);
+		unsigned int elementSize = (registers - 1) * 16 + registerWidth(var) * 4;
+		unsigned int elementStride = registers * 16;
+		var.size = var.elements > 0 ? (var.elements - 1) * elementStride + elementSize : elementSize;
+		return var;
+	}
+
+	void parseType(const std::string& type, ParsedConstantBufferVariable& var)
+	{
+		static const char* scalars[] = { "float", "int", "uint", "bool", "dword", "half" };
+		std::string base;
+		for (int i = 0; i < 6; i++)
+		{
+			if (type.compare(0, strlen(scalars[i]), scalars[i]) == 0)
+			{
+				base = scalars[i];
+			}
+		}
+		if (type == "matrix")
+		{
+			var.type = "float";
+			var.rows = 4;
+			var.columns = 4;
+			var.matrix = true;
+			return;
+		}
+		if (base.empty())
+		{
+			throw std::runtime_error("Unsupported cbuffer variable type: " + type);
+		}
+		var.type = (base == "dword") ? "uint" : (base == "half" ? "float" : base);
+		std::string dims = type.substr(base.size());
+		var.rows = 1;
+		var.columns = 1;
+		if (dims.size() == 1 && dims[0] >= '1' && dims[0] <= '4')
+		{
+			var.columns = dims[0] - '0';
+		} else if (dims.size() == 3 && dims[1] == 'x')
+		{
+			var.rows = dims[0] - '0';
+			var.columns = dims[2] - '0';
+			var.matrix = true;
+		} else if (!dims.empty())
+		{
+			throw std::runtime_error("Unsupported cbuffer variable type: " + type);
+		}
+	}
+
+	// A matrix takes one register per column, or per row when row_major, so a column-major
+	// float1x4 is four registers while a row_major one packs like a float4
+	static unsigned int registerCount(const ParsedConstantBufferVariable& var)
+	{
+		if (!var.matrix)
+		{
+			return 1;
+		}
+		return var.rowMajor ? var.rows : var.columns;
+	}
+
+	static unsigned int registerWidth(const ParsedConstantBufferVariable& var)
+	{
+		if (!var.matrix)
+		{
+			return var.columns;
+		}
+		return var.rowMajor ? var.columns : var.rows;
+	}
+
+	std::string cppDeclaration(const ParsedConstantBufferVariable& var, unsigned int& cppSize)
+	{
+		std::string scalar = var.type == "float" ? "float" : (var.type == "uint" ? "unsigned int" : "int");
+		std::stringstream decl;
+		decl << scalar << " " << var.name;
+		unsigned int registers = registerCount(var);
+		unsigned int width = registerWidth(var);
+		if (var.elements > 0)
+		{
+			decl << "[" << var.elements << "]";
+		}
+		if (var.elements > 0 || registers > 1)
+		{
+			// Each element or matrix register occupies a full 16-byte register
+			if (registers > 1)
+			{
+				decl << "[" << registers << "]";
+			}
+			decl << "[4]";
+			cppSize = (var.elements > 0 ? var.elements : 1) * registers * 16;
+		} else
+		{
+			if (width > 1)
+			{
+				decl << "[" << width << "]";
+			}
+			cppSize = width * 4;
+		}
+		return decl.str();
+	}
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <D3D11.h>
+#include <d3d11_1.h>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+#include <cstring>
+
+#include "Core.h"
+#include "ShaderPeflection.h"
+#include "ConstantBufferRingAllocator.h"
+
+// Offsets passed to VSSetConstantBuffers1 must be multiples of 16 constants (256 bytes)
+#define CONSTANT_BUFFER_RING_ALIGNMENT 256
+
+// Per-frame constant data carved out of a few large dynamic buffers. Slices are written
+// through Map(NO_OVERWRITE) and bound with VSSetConstantBuffers1/PSSetConstantBuffers1.
+// Write every slice a batch needs with write(), call unmap() once, then bind() the slices: a
+// page stays mapped until unmap(), so a batch costs one Map per page rather than one per buffer.
+// Devices without D3D11.1 constant buffer offsetting fall back to one dynamic buffer per
+// stage and slot, updated with Map(WRITE_DISCARD).
+class ConstantBufferRing
+{
+public:
+	struct Page
+	{
+		ID3D11Buffer* buffer = nullptr;
+		unsigned char* mapped = nullptr;
+		ConstantBufferRingAllocator allocator;
+	};
+	std::vector<Page> pages;
+	int currentPage = 0;
+	bool offsetBinding = false;
+	unsigned long long frame = 0;
+	unsigned long long completedFrame = 0;
+	std::deque<std::pair<unsigned long long, ID3D11Query*>> frameQueries;
+	std::vector<ID3D11Query*> freeQueries;
+	ID3D11Buffer* fallbackBuffers[2][D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {};
+	unsigned int fallbackSizes[2][D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {};
+	unsigned int mapsThisFrame = 0;
+
+	void init(Core* core, unsigned int pageSizeInBytes, int pageCount)
+	{
+		offsetBinding = core->deviceContext1 != nullptr && core->supportsConstantBufferOffsetting && core->supportsMapNoOverwriteOnDynamicConstantBuffer;
+		if (!offsetBinding)
+		{
+			return;
+		}
+		unsigned int pageSize = (pageSizeInBytes + CONSTANT_BUFFER_RING_ALIGNMENT - 1) & ~(CONSTANT_BUFFER_RING_ALIGNMENT - 1);
+		pages.resize(pageCount);
+		for (int i = 0; i < pageCount; i++)
+		{
+			D3D11_BUFFER_DESC bd = {};
+			bd.Usage = D3D11_USAGE_DYNAMIC;
+			bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+			bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			bd.ByteWidth = pageSize;
+			if (FAILED(core->device->CreateBuffer(&bd, NULL, &pages[i].buffer)))
+			{
+				throw std::runtime_error("Failed to create constant buffer ring page.");
+			}
+			pages[i].allocator.init(pageSize);
+		}
+	}
+
+	// Reserves a 256-byte aligned slice for this frame and returns a CPU pointer to fill
+	ConstantBufferSlice allocate(Core* core, unsigned int sizeInBytes)
+	{
+		unsigned int size = (sizeInBytes + CONSTANT_BUFFER_RING_ALIGNMENT - 1) & ~(CONSTANT_BUFFER_RING_ALIGNMENT - 1);
+		ConstantBufferSlice slice;
+		unsigned int offset = 0;
+		while (true)
+		{
+			for (size_t n = 0; n < pages.size(); n++)
+			{
+				int i = (currentPage + (int)n) % (int)pages.size();
+				if (pages[i].allocator.allocate(size, CONSTANT_BUFFER_RING_ALIGNMENT, offset))
+				{
+					currentPage = i;
+					Page& page = pages[i];
+					if (page.mapped == nullptr)
+					{
+						D3D11_MAPPED_SUBRESOURCE mapped;
+						if (FAILED(core->deviceContext->Map(page.buffer, 0, D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped)))
+						{
+							throw std::runtime_error("Failed to map constant buffer ring page.");
+						}
+						page.mapped = (unsigned char*)mapped.pData;
+						mapsThisFrame++;
+					}
+					slice.buffer = page.buffer;
+					slice.offset = offset;
+					slice.size = size;
+					slice.data = page.mapped + offset;
+					return slice;
+				}
+			}
+			// Every page is full of in-flight data, wait for the GPU to finish the oldest frame
+			if (frameQueries.empty())
+			{
+				throw std::runtime_error("Constant buffer ring is too small for one frame.");
+			}
+			waitForFrame(core, frameQueries.front().first);
+		}
+	}
+
+	// Copies data into a new slice without binding it
+	ConstantBufferSlice write(Core* core, const void* data, unsigned int sizeInBytes)
+	{
+		ConstantBufferSlice slice = allocate(core, sizeInBytes);
+		memcpy(slice.data, data, sizeInBytes);
+		return slice;
+	}
+
+	// Gives each buffer one slice per frame, rewritten only when the data changes. A buffer shared
+	// by several shaders or stages is then written once and bound at the same offset everywhere.
+	ConstantBufferSlice write(Core* core, ConstantBuffer& buffer)
+	{
+		if (buffer.dirty != 1 && buffer.ringSlice.buffer != nullptr && buffer.ringFrame == frame)
+		{
+			return buffer.ringSlice;
+		}
+		ConstantBufferSlice slice = allocate(core, buffer.cbSizeInBytes);
+		// A new slice needs every byte, not just the registers that changed
+		buffer.dirty = 1;
+		buffer.flush(false, [&slice, &buffer](unsigned int offset, unsigned int size)
+		{
+			memcpy(slice.data + offset, &buffer.buffer[offset], size);
+		});
+		buffer.ringSlice = slice;
+		buffer.ringFrame = frame;
+		return slice;
+	}
+
+	// Call after the last write() of a batch, before the draws that read it
+	void unmap(Core* core)
+	{
+		for (size_t i = 0; i < pages.size(); i++)
+		{
+			if (pages[i].mapped != nullptr)
+			{
+				core->deviceContext->Unmap(pages[i].buffer, 0);
+				pages[i].mapped = nullptr;
+			}
+		}
+	}
+
+	// The slice's page must be unmapped before a draw reads it
+	void bind(Core* core, ShaderStage stage, int slot, const ConstantBufferSlice& slice)
+	{
+		core->setConstantBuffer1(stage, slot, slice.buffer, slice.offset / 16, slice.size / 16);
+	}
+
+	// Copies data into the ring (or the fallback buffer for the slot) and binds it straight
+	// away. This maps and unmaps for every call, use write/unmap/bind for anything per draw.
+	void upload(Core* core, ShaderStage stage, int slot, const void* data, unsigned int sizeInBytes)
+	{
+		if (offsetBinding)
+		{
+			ConstantBufferSlice slice = write(core, data, sizeInBytes);
+			unmap(core);
+			bind(core, stage, slot, slice);
+			return;
+		}
+		ID3D11Buffer*& fallback = fallbackBuffers[stage][slot];
+		unsigned int sizeInBytes16 = (sizeInBytes + 15) & -16;
+		if (fallbackSizes[stage][slot] < sizeInBytes16)
+		{
+			if (fallback)
+			{
+				fallback->Release();
+			}
+			D3D11_BUFFER_DESC bd = {};
+			bd.Usage = D3D11_USAGE_DYNAMIC;
+			bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+			bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			bd.ByteWidth = sizeInBytes16;
+			if (FAILED(core->device->CreateBuffer(&bd, NULL, &fallback)))
+			{
+				throw std::runtime_error("Failed to create fallback constant buffer.");
+			}
+			fallbackSizes[stage][slot] = sizeInBytes16;
+		}
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(core->deviceContext->Map(fallback, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		{
+			throw std::runtime_error("Failed to map fallback constant buffer.");
+		}
+		memcpy(mapped.pData, data, sizeInBytes);
+		core->deviceContext->Unmap(fallback, 0);
+		mapsThisFrame++;
+		core->setConstantBuffer(stage, slot, fallback);
+	}
+
+	// Call once per frame after the last draw that uses this frame's slices
+	void endFrame(Core* core)
+	{
+		unmap(core);
+		if (offsetBinding)
+		{
+			for (size_t i = 0; i < pages.size(); i++)
+			{
+				pages[i].allocator.endFrame(frame);
+			}
+			ID3D11Query* query = nullptr;
+			if (!freeQueries.empty())
+			{
+				query = freeQueries.back();
+				freeQueries.pop_back();
+			} else
+			{
+				D3D11_QUERY_DESC qd = {};
+				qd.Query = D3D11_QUERY_EVENT;
+				core->device->CreateQuery(&qd, &query);
+			}
+			core->deviceContext->End(query);
+			frameQueries.push_back({ frame, query });
+			// Retire whatever the GPU has already finished without stalling
+			while (!frameQueries.empty())
+			{
+				BOOL done = FALSE;
+				if (core->deviceContext->GetData(frameQueries.front().second, &done, sizeof(BOOL), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				{
+					break;
+				}
+				retire(frameQueries.front().first);
+			}
+		}
+		frame++;
+		mapsThisFrame = 0;
+	}
+
+	void waitForFrame(Core* core, unsigned long long fence)
+	{
+		while (!frameQueries.empty() && frameQueries.front().first <= fence)
+		{
+			BOOL done = FALSE;
+			while (core->deviceContext->GetData(frameQueries.front().second, &done, sizeof(BOOL), 0) != S_OK)
+			{
+			}
+			retire(frameQueries.front().first);
+		}
+	}
+
+	void release()
+	{
+		for (size_t i = 0; i < pages.size(); i++)
+		{
+			pages[i].buffer->Release();
+		}
+		pages.clear();
+		for (size_t i = 0; i < frameQueries.size(); i++)
+		{
+			frameQueries[i].second->Release();
+		}
+		frameQueries.clear();
+		for (size_t i = 0; i < freeQueries.size(); i++)
+		{
+			freeQueries[i]->Release();
+		}
+		freeQueries.clear();
+		for (int s = 0; s < 2; s++)
+		{
+			for (int i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; i++)
+			{
+				if (fallbackBuffers[s][i])
+				{
+					fallbackBuffers[s][i]->Release();
+					fallbackBuffers[s][i] = nullptr;
+					fallbackSizes[s][i] = 0;
+				}
+			}
+		}
+	}
+
+private:
+	void retire(unsigned long long fence)
+	{
+		for (size_t i = 0; i < pages.size(); i++)
+		{
+			pages[i].allocator.retire(fence);
+		}
+		completedFrame = fence;
+		freeQueries.push_back(frameQueries.front().second);
+		frameQueries.pop_front();
+	}
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <deque>
+
+// Linear ring allocator with frame fences. Holds no D3D objects, so the offset, fence and
+// wraparound logic can be driven on its own.
+class ConstantBufferRingAllocator
+{
+public:
+	struct FrameMarker
+	{
+		unsigned long long fence;
+		unsigned int head;
+		unsigned int bytes;
+	};
+	unsigned int capacity = 0;
+	unsigned int head = 0;
+	unsigned int tail = 0;
+	unsigned int used = 0;
+	unsigned int frameBytes = 0;
+	std::deque<FrameMarker> frames;
+	void init(unsigned int capacityInBytes)
+	{
+		capacity = capacityInBytes;
+		head = 0;
+		tail = 0;
+		used = 0;
+		frameBytes = 0;
+		frames.clear();
+	}
+	// Returns false if there is no room until older frames are retired
+	bool allocate(unsigned int size, unsigned int alignment, unsigned int& offset)
+	{
+		if (size == 0 || size > capacity)
+		{
+			return false;
+		}
+		if (used == 0)
+		{
+			// Start again from the front once nothing is in flight. Frames that allocated nothing
+			// still hold markers with the current head, which retire() will copy into tail, so
+			// head can only move while no markers are left.
+			if (frames.empty())
+			{
+				head = 0;
+				tail = 0;
+			}
+		} else if (head == tail)
+		{
+			return false;
+		}
+		unsigned int aligned = (head + alignment - 1) & ~(alignment - 1);
+		unsigned int consumed = 0;
+		if (head >= tail)
+		{
+			if (aligned + size <= capacity)
+			{
+				offset = aligned;
+				consumed = aligned + size - head;
+			} else if (size <= tail)
+			{
+				// Skip the end of the buffer and wrap to the start
+				offset = 0;
+				consumed = capacity - head + size;
+			} else
+			{
+				return false;
+			}
+		} else
+		{
+			if (aligned + size > tail)
+			{
+				return false;
+			}
+			offset = aligned;
+			consumed = aligned + size - head;
+		}
+		head = (offset + size) % capacity;
+		used += consumed;
+		frameBytes += consumed;
+		return true;
+	}
+	// Everything allocated since the last endFrame belongs to this fence
+	void endFrame(unsigned long long fence)
+	{
+		FrameMarker marker;
+		marker.fence = fence;
+		marker.head = head;
+		marker.bytes = frameBytes;
+		frames.push_back(marker);
+		frameBytes = 0;
+	}
+	// The GPU has finished with every frame up to and including completedFence
+	void retire(unsigned long long completedFence)
+	{
+		while (!frames.empty() && frames.front().fence <= completedFence)
+		{
+			tail = frames.front().head;
+			used -= frames.front().bytes;
+			frames.pop_front();
+		}
+	}
+};
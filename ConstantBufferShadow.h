@@ -0,0 +1,196 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+struct ConstantBufferVariable
+{
+	unsigned int offset;
+	unsigned int size;
+};
+
+// FNV-1a hash of a variable name. constexpr so names can be hashed at compile time:
+// constexpr unsigned int worldHash = hashConstantBufferName("world");
+constexpr unsigned int hashConstantBufferName(const char* str, unsigned int hash = 2166136261u)
+{
+	return (*str == 0) ? hash : hashConstantBufferName(str + 1, (hash ^ static_cast<unsigned char>(*str)) * 16777619u);
+}
+
+// Resolved location of a variable inside a constant buffer. Look it up once with getHandle
+// and keep it, update(handle, data) then does no hashing, searching or allocation.
+struct ConstantBufferHandle
+{
+	unsigned int offset = 0;
+	unsigned int size = 0;
+	bool isValid() const
+	{
+		return size > 0;
+	}
+};
+
+// CPU side of a constant buffer: the variable table and the shadow copy of its contents.
+// Holds no D3D objects, ConstantBuffer adds the GPU buffer and the upload.
+class ConstantBufferShadow
+{
+public:
+	std::string name;
+	std::map<std::string, ConstantBufferVariable> constantBufferData;
+	std::map<unsigned int, ConstantBufferVariable> constantBufferHashes;
+	unsigned char* buffer;
+	unsigned int cbSizeInBytes;
+	int dirty;
+	// One bit per 16-byte register that changed since the last upload
+	std::vector<unsigned long long> dirtyRegisters;
+	// Bytes actually copied, and bytes a full re-copy on every upload would have copied
+	unsigned long long bytesUploaded;
+	unsigned long long bytesFullUpload;
+	// Number of times the data was actually sent to the GPU
+	unsigned long long uploadCount;
+	// Creates the zeroed shadow copy, rounded up to whole registers, with everything dirty
+	void allocate(unsigned int sizeInBytes)
+	{
+		unsigned int sizeInBytes16 = ((sizeInBytes + 15) & -16);
+		buffer = new unsigned char[sizeInBytes16];
+		memset(buffer, 0, sizeInBytes16);
+		cbSizeInBytes = sizeInBytes;
+		dirtyRegisters.assign(((sizeInBytes16 / 16) + 63) / 64, 0);
+		markDirty(0, sizeInBytes16);
+		bytesUploaded = 0;
+		bytesFullUpload = 0;
+		uploadCount = 0;
+	}
+	void markDirty(unsigned int offset, unsigned int size)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		unsigned int last = (offset + size - 1) / 16;
+		for (unsigned int i = offset / 16; i <= last; i++)
+		{
+			dirtyRegisters[i / 64] |= 1ull << (i % 64);
+		}
+		dirty = 1;
+	}
+	bool isRegisterDirty(unsigned int i) const
+	{
+		return (dirtyRegisters[i / 64] >> (i % 64)) & 1ull;
+	}
+	// Throws if the name hashes to the same value as a different variable, a handle looked up
+	// by hash would otherwise silently write the other variable's bytes
+	void addVariable(const std::string& variableName, unsigned int offset, unsigned int size)
+	{
+		unsigned int hash = hashConstantBufferName(variableName.c_str());
+		if (constantBufferHashes.count(hash) && !constantBufferData.count(variableName))
+		{
+			for (auto it = constantBufferData.begin(); it != constantBufferData.end(); ++it)
+			{
+				if (hashConstantBufferName(it->first.c_str()) == hash)
+				{
+					throw std::runtime_error("Constant buffer " + name + " variables " + it->first + " and " + variableName + " have the same name hash.");
+				}
+			}
+		}
+		ConstantBufferVariable bufferVariable;
+		bufferVariable.offset = offset;
+		bufferVariable.size = size;
+		constantBufferData.insert({ variableName, bufferVariable });
+		constantBufferHashes.insert({ hash, bufferVariable });
+	}
+	// Returns an invalid handle if the variable does not exist
+	ConstantBufferHandle getHandle(unsigned int nameHash) const
+	{
+		ConstantBufferHandle handle;
+		auto it = constantBufferHashes.find(nameHash);
+		if (it != constantBufferHashes.end())
+		{
+			handle.offset = it->second.offset;
+			handle.size = it->second.size;
+		}
+		return handle;
+	}
+	ConstantBufferHandle getHandle(const std::string& variableName) const
+	{
+		return getHandle(hashConstantBufferName(variableName.c_str()));
+	}
+	void update(const ConstantBufferHandle& handle, const void* data)
+	{
+		memcpy(&buffer[handle.offset], data, handle.size);
+		markDirty(handle.offset, handle.size);
+	}
+	// Slow path, prefer resolving a handle once. Unknown names are ignored rather than inserted.
+	void update(const std::string& variableName, const void* data)
+	{
+		auto it = constantBufferData.find(variableName);
+		if (it == constantBufferData.end())
+		{
+			return;
+		}
+		memcpy(&buffer[it->second.offset], data, it->second.size);
+		markDirty(it->second.offset, it->second.size);
+	}
+	// Hands the changed bytes to copy(offset, size) and clears the dirty state. With partial set,
+	// each run of consecutive dirty registers is copied on its own, otherwise the whole buffer
+	// is copied once. Returns false if nothing had changed.
+	template<typename CopyFunction>
+	bool flush(bool partial, CopyFunction copy)
+	{
+		if (dirty != 1)
+		{
+			return false;
+		}
+		uploadCount++;
+		bytesFullUpload += cbSizeInBytes;
+		if (partial)
+		{
+			unsigned int registers = (cbSizeInBytes + 15) / 16;
+			unsigned int i = 0;
+			while (i < registers)
+			{
+				if (dirtyRegisters[i / 64] == 0)
+				{
+					i = (i / 64 + 1) * 64;
+					continue;
+				}
+				if (!isRegisterDirty(i))
+				{
+					i++;
+					continue;
+				}
+				unsigned int start = i;
+				while (i < registers && isRegisterDirty(i))
+				{
+					i++;
+				}
+				copy(start * 16, (i - start) * 16);
+				bytesUploaded += (i - start) * 16;
+			}
+		} else
+		{
+			copy(0u, cbSizeInBytes);
+			bytesUploaded += cbSizeInBytes;
+		}
+		std::fill(dirtyRegisters.begin(), dirtyRegisters.end(), 0ull);
+		dirty = 0;
+		return true;
+	}
+	// Hash of the variable names, offsets and sizes, used to tell same-named buffers apart
+	unsigned int computeLayoutHash() const
+	{
+		unsigned int hash = hashConstantBufferName(name.c_str());
+		for (auto it = constantBufferData.begin(); it != constantBufferData.end(); ++it)
+		{
+			hash = hashConstantBufferName(it->first.c_str(), hash);
+			unsigned int values[2] = { it->second.offset, it->second.size };
+			for (int i = 0; i < 8; i++)
+			{
+				hash = (hash ^ reinterpret_cast<const unsigned char*>(values)[i]) * 16777619u;
+			}
+		}
+		return (hash ^ cbSizeInBytes) * 16777619u;
+	}
+};
@@ -1,11 +1,14 @@
 ﻿
 #pragma once
 #include <d3d11.h>
+#include <d3d11_1.h>
 #include <stdexcept>
 #include <cstring>
 #include <D3D11.h>
 #include <vector>
 #include <dxgi1_6.h>
+#include "VertexFormat.h"
+#include "PipelineStateCache.h"
 
 #pragma comment(lib, "D3D11.lib")
 #pragma comment(lib, "D3DCompiler.lib")
@@ -15,6 +18,11 @@ class Core {
 public:
     ID3D11Device* device;
     ID3D11DeviceContext* deviceContext;
+    // D3D11.1 上下文，用于常量缓冲区的部分更新和偏移绑定（不支持时为 nullptr）
+    ID3D11DeviceContext1* deviceContext1 = nullptr;
+    bool supportsConstantBufferPartialUpdate = false;
+    bool supportsConstantBufferOffsetting = false;
+    bool supportsMapNoOverwriteOnDynamicConstantBuffer = false;
     IDXGISwapChain* swapChain;
 
 
@@ -27,6 +35,25 @@ public:
     ID3D11RasterizerState* rasterizerState;
     ID3D11DepthStencilState* depthStencilState;
 
+    // 绑定状态缓存：记录每个阶段和槽位当前绑定的对象，跳过重复的 API 调用
+    struct BoundConstantBuffer {
+        ID3D11Buffer* buffer = nullptr;
+        UINT firstConstant = 0;
+        UINT numConstants = 0;
+    };
+    ID3D11VertexShader* boundVertexShader = nullptr;
+    ID3D11PixelShader* boundPixelShader = nullptr;
+    ID3D11InputLayout* boundInputLayout = nullptr;
+    BoundConstantBuffer boundConstantBuffers[2][D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+    unsigned long long stateCallsIssued = 0;
+    unsigned long long stateCallsElided = 0;
+
+    // 输入布局缓存：相同的顶点格式和顶点着色器输入签名只创建一次
+    InputLayoutCache inputLayouts;
+
+    // 光栅化、混合、深度模板状态缓存：相同描述的状态对象只创建一次，由缓存持有
+    PipelineStateCache states;
+
     IDXGIAdapter1* GetAdapter() {
         IDXGIAdapter1* adapterf;
         std::vector<IDXGIAdapter1*> adapters;
@@ -99,6 +126,15 @@ public:
             &deviceContext
         );
 
+        // 查询 D3D11.1 常量缓冲区功能
+        if (SUCCEEDED(deviceContext->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&deviceContext1))) {
+            D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+            device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options));
+            supportsConstantBufferPartialUpdate = options.ConstantBufferPartialUpdate == TRUE;
+            supportsConstantBufferOffsetting = options.ConstantBufferOffsetting == TRUE;
+            supportsMapNoOverwriteOnDynamicConstantBuffer = options.MapNoOverwriteOnDynamicConstantBuffer == TRUE;
+        }
+
         swapChain->SetFullscreenState(window_fullscreen, NULL);
 
         swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&backbuffer);
@@ -141,26 +177,106 @@ public:
         swapChain->Present(0, 0);
     }
 
+    void setVertexShader(ID3D11VertexShader* shader) {
+        if (boundVertexShader == shader) {
+            stateCallsElided++;
+            return;
+        }
+        deviceContext->VSSetShader(shader, NULL, 0);
+        boundVertexShader = shader;
+        stateCallsIssued++;
+    }
+
+    void setPixelShader(ID3D11PixelShader* shader) {
+        if (boundPixelShader == shader) {
+            stateCallsElided++;
+            return;
+        }
+        deviceContext->PSSetShader(shader, NULL, 0);
+        boundPixelShader = shader;
+        stateCallsIssued++;
+    }
+
+    void setInputLayout(ID3D11InputLayout* layout) {
+        if (boundInputLayout == layout) {
+            stateCallsElided++;
+            return;
+        }
+        deviceContext->IASetInputLayout(layout);
+        boundInputLayout = layout;
+        stateCallsIssued++;
+    }
+
+    // stage 与 ShaderStage 一致：0 为顶点着色器，1 为像素着色器
+    void setConstantBuffer(int stage, int slot, ID3D11Buffer* buffer) {
+        BoundConstantBuffer& bound = boundConstantBuffers[stage][slot];
+        if (bound.buffer == buffer && bound.numConstants == 0) {
+            stateCallsElided++;
+            return;
+        }
+        if (stage == 0) deviceContext->VSSetConstantBuffers(slot, 1, &buffer);
+        if (stage == 1) deviceContext->PSSetConstantBuffers(slot, 1, &buffer);
+        bound.buffer = buffer;
+        bound.firstConstant = 0;
+        bound.numConstants = 0;
+        stateCallsIssued++;
+    }
+
+    // 按偏移绑定常量缓冲区（需要 D3D11.1）
+    void setConstantBuffer1(int stage, int slot, ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants) {
+        BoundConstantBuffer& bound = boundConstantBuffers[stage][slot];
+        if (bound.buffer == buffer && bound.firstConstant == firstConstant && bound.numConstants == numConstants) {
+            stateCallsElided++;
+            return;
+        }
+        if (stage == 0) deviceContext1->VSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants);
+        if (stage == 1) deviceContext1->PSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants);
+        bound.buffer = buffer;
+        bound.firstConstant = firstConstant;
+        bound.numConstants = numConstants;
+        stateCallsIssued++;
+    }
+
+    // 在缓存之外直接修改了上下文状态后调用，使下一次绑定一定会发出
+    void invalidateStateCache() {
+        boundVertexShader = nullptr;
+        boundPixelShader = nullptr;
+        boundInputLayout = nullptr;
+        for (int stage = 0; stage < 2; stage++) {
+            for (int slot = 0; slot < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; slot++) {
+                boundConstantBuffers[stage][slot] = BoundConstantBuffer();
+            }
+        }
+    }
+
+    void resetStateCounters() {
+        stateCallsIssued = 0;
+        stateCallsElided = 0;
+    }
+
     void SetupRasterizerState() {
         D3D11_RASTERIZER_DESC rsdesc;
         ZeroMemory(&rsdesc, sizeof(D3D11_RASTERIZER_DESC));
         rsdesc.FillMode = D3D11_FILL_SOLID;
         rsdesc.CullMode = D3D11_CULL_NONE;
-        device->CreateRasterizerState(&rsdesc, &rasterizerState);
+        rasterizerState = states.getRasterizerState(device, rsdesc);
         deviceContext->RSSetState(rasterizerState);
     }
 
+    // 深度测试开启（LESS，写入深度），模板测试关闭
     void SetupDepthStencilState() {
         D3D11_DEPTH_STENCIL_DESC depthStencilDesc;
-        BOOL DepthEnable;
-        D3D11_DEPTH_WRITE_MASK DepthWriteMask;
-        D3D11_COMPARISON_FUNC DepthFunc;
-        BOOL StencilEnable;
-        UINT8 StencilReadMask;
-        UINT8 StencilWriteMask;
-        D3D11_DEPTH_STENCILOP_DESC FrontFace;
-        D3D11_DEPTH_STENCILOP_DESC BackFace;
-        device->CreateDepthStencilState(&depthStencilDesc, &depthStencilState);
+        ZeroMemory(&depthStencilDesc, sizeof(D3D11_DEPTH_STENCIL_DESC));
+        depthStencilDesc.DepthEnable = TRUE;
+        depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+        depthStencilDesc.DepthFunc = D3D11_COMPARISON_LESS;
+        depthStencilDesc.StencilEnable = FALSE;
+        depthStencilDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+        depthStencilDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+        D3D11_DEPTH_STENCILOP_DESC stencilOp = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_COMPARISON_ALWAYS };
+        depthStencilDesc.FrontFace = stencilOp;
+        depthStencilDesc.BackFace = stencilOp;
+        depthStencilState = states.getDepthStencilState(device, depthStencilDesc);
         deviceContext->OMSetDepthStencilState(depthStencilState, 0);
     }
 };
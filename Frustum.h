@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cmath>
+
+// View frustum as six normalised planes (a, b, c, d). A point p is inside a plane when
+// a * p.x + b * p.y + c * p.z + d >= 0, and the plane value is its distance in world units.
+struct Frustum
+{
+	enum Plane
+	{
+		Left,
+		Right,
+		Bottom,
+		Top,
+		Near,
+		Far,
+		PlaneCount
+	};
+
+	float planes[PlaneCount][4] = {};
+
+	// Gribb-Hartmann extraction from a row-major view-projection matrix used as
+	// clip = m * (x, y, z, 1), with the OpenGL clip volume -w <= x, y, z <= w
+	static Frustum fromMatrix(const float* m)
+	{
+		Frustum f;
+		for (int k = 0; k < 4; k++)
+		{
+			f.planes[Left][k] = m[12 + k] + m[k];
+			f.planes[Right][k] = m[12 + k] - m[k];
+			f.planes[Bottom][k] = m[12 + k] + m[4 + k];
+			f.planes[Top][k] = m[12 + k] - m[4 + k];
+			f.planes[Near][k] = m[12 + k] + m[8 + k];
+			f.planes[Far][k] = m[12 + k] - m[8 + k];
+		}
+		f.normalise();
+		return f;
+	}
+
+	// view comes from Matrix::lookAt (row-major, translation in m[3], m[7], m[11]).
+	// Matrix::Perspective stores its terms transposed relative to that (the -1 is in m[11],
+	// not m[14]), so it is transposed here before the two are multiplied.
+	static Frustum fromViewPerspective(const float* view, const float* perspective)
+	{
+		float p[16];
+		for (int r = 0; r < 4; r++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				p[r * 4 + c] = perspective[c * 4 + r];
+			}
+		}
+		float m[16];
+		for (int r = 0; r < 4; r++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				m[r * 4 + c] = p[r * 4] * view[c] + p[r * 4 + 1] * view[4 + c] + p[r * 4 + 2] * view[8 + c] + p[r * 4 + 3] * view[12 + c];
+			}
+		}
+		return fromMatrix(m);
+	}
+
+	void normalise()
+	{
+		for (int i = 0; i < PlaneCount; i++)
+		{
+			float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+			if (length > 0.0f)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					planes[i][k] /= length;
+				}
+			}
+		}
+	}
+
+	bool intersectsSphere(const float* center, float radius) const
+	{
+		for (int i = 0; i < PlaneCount; i++)
+		{
+			if (planes[i][0] * center[0] + planes[i][1] * center[1] + planes[i][2] * center[2] + planes[i][3] < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+
+#include "SIMDConfig.h"
+#include "Frustum.h"
+#include "GEMLoader.h"
+#include "ThreadPool.h"
+
+// Axis-aligned box and bounding sphere of a mesh, computed once at load time
+struct MeshBounds
+{
+	float boxMin[3] = { 0, 0, 0 };
+	float boxMax[3] = { 0, 0, 0 };
+	float center[3] = { 0, 0, 0 };
+	float radius = 0;
+
+	// positions points at the first vertex's x, y, z floats. The sphere is centred on the box
+	// and grown to the furthest vertex, so it is never larger than the box's circumsphere.
+	static MeshBounds fromPositions(const void* positions, size_t stride, unsigned int vertexCount)
+	{
+		MeshBounds bounds;
+		if (vertexCount == 0)
+		{
+			return bounds;
+		}
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+		for (int k = 0; k < 3; k++)
+		{
+			bounds.boxMin[k] = FLT_MAX;
+			bounds.boxMax[k] = -FLT_MAX;
+		}
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			const float* p = position(v);
+			for (int k = 0; k < 3; k++)
+			{
+				bounds.boxMin[k] = fminf(bounds.boxMin[k], p[k]);
+				bounds.boxMax[k] = fmaxf(bounds.boxMax[k], p[k]);
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			bounds.center[k] = (bounds.boxMin[k] + bounds.boxMax[k]) * 0.5f;
+		}
+		float radiusSquared = 0;
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			const float* p = position(v);
+			float dx = p[0] - bounds.center[0];
+			float dy = p[1] - bounds.center[1];
+			float dz = p[2] - bounds.center[2];
+			radiusSquared = fmaxf(radiusSquared, dx * dx + dy * dy + dz * dz);
+		}
+		bounds.radius = sqrtf(radiusSquared);
+		return bounds;
+	}
+
+	static MeshBounds fromGEMMesh(const GEMLoader::GEMMesh& mesh)
+	{
+		if (!mesh.verticesAnimated.empty())
+		{
+			return fromPositions(&mesh.verticesAnimated[0].position, sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()));
+		}
+		if (mesh.verticesStatic.empty())
+		{
+			return MeshBounds();
+		}
+		return fromPositions(&mesh.verticesStatic[0].position, sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()));
+	}
+
+	void merge(const MeshBounds& other)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			boxMin[k] = fminf(boxMin[k], other.boxMin[k]);
+			boxMax[k] = fmaxf(boxMax[k], other.boxMax[k]);
+		}
+		float d[3] = { other.center[0] - center[0], other.center[1] - center[1], other.center[2] - center[2] };
+		float distance = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		if (distance + other.radius <= radius)
+		{
+			return;
+		}
+		if (distance + radius <= other.radius)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				center[k] = other.center[k];
+			}
+			radius = other.radius;
+			return;
+		}
+		float newRadius = (distance + radius + other.radius) * 0.5f;
+		for (int k = 0; k < 3; k++)
+		{
+			center[k] += d[k] * (newRadius - radius) / distance;
+		}
+		radius = newRadius;
+	}
+
+	// Bounds of this mesh after a row-major world matrix with translation in m[3], m[7], m[11].
+	// The box is transformed with Arvo's method, the sphere radius grows by the largest scale.
+	MeshBounds transformed(const float* m) const
+	{
+		MeshBounds result;
+		float scaleSquared = 0;
+		for (int r = 0; r < 3; r++)
+		{
+			result.boxMin[r] = m[r * 4 + 3];
+			result.boxMax[r] = m[r * 4 + 3];
+			result.center[r] = m[r * 4 + 3];
+			for (int c = 0; c < 3; c++)
+			{
+				float a = m[r * 4 + c] * boxMin[c];
+				float b = m[r * 4 + c] * boxMax[c];
+				result.boxMin[r] += fminf(a, b);
+				result.boxMax[r] += fmaxf(a, b);
+				result.center[r] += m[r * 4 + c] * center[c];
+			}
+			float column = m[r] * m[r] + m[4 + r] * m[4 + r] + m[8 + r] * m[8 + r];
+			scaleSquared = fmaxf(scaleSquared, column);
+		}
+		result.radius = radius * sqrtf(scaleSquared);
+		return result;
+	}
+};
+
+// World-space bounds of many objects in structure-of-arrays form for the culling kernels.
+// Arrays are padded to a multiple of 8 with boxes that every plane rejects.
+class CullingSet
+{
+public:
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> extentX, extentY, extentZ;
+	unsigned int count = 0;
+
+	void reserve(unsigned int objects)
+	{
+		size_t padded = (objects + 7) & ~7u;
+		for (std::vector<float>* a : arrays())
+		{
+			a->reserve(padded);
+		}
+	}
+
+	void clear()
+	{
+		for (std::vector<float>* a : arrays())
+		{
+			a->clear();
+		}
+		count = 0;
+	}
+
+	// Returns the object's index for set() and for reading cull results
+	unsigned int add(const MeshBounds& bounds)
+	{
+		unsigned int index = count++;
+		if (index >= centerX.size())
+		{
+			for (std::vector<float>* a : arrays())
+			{
+				a->resize(index + 8, 0.0f);
+			}
+			// Padding lanes: a zero box with a huge negative radius fails every sphere test
+			for (size_t i = index; i < index + 8; i++)
+			{
+				radius[i] = -FLT_MAX;
+			}
+		}
+		set(index, bounds);
+		return index;
+	}
+
+	void set(unsigned int index, const MeshBounds& bounds)
+	{
+		centerX[index] = (bounds.boxMin[0] + bounds.boxMax[0]) * 0.5f;
+		centerY[index] = (bounds.boxMin[1] + bounds.boxMax[1]) * 0.5f;
+		centerZ[index] = (bounds.boxMin[2] + bounds.boxMax[2]) * 0.5f;
+		extentX[index] = (bounds.boxMax[0] - bounds.boxMin[0]) * 0.5f;
+		extentY[index] = (bounds.boxMax[1] - bounds.boxMin[1]) * 0.5f;
+		extentZ[index] = (bounds.boxMax[2] - bounds.boxMin[2]) * 0.5f;
+		// The sphere test uses the box centre, so cover the box with the smaller of the two spheres
+		float boxRadius = sqrtf(extentX[index] * extentX[index] + extentY[index] * extentY[index] + extentZ[index] * extentZ[index]);
+		float dx = bounds.center[0] - centerX[index];
+		float dy = bounds.center[1] - centerY[index];
+		float dz = bounds.center[2] - centerZ[index];
+		radius[index] = fminf(boxRadius, bounds.radius + sqrtf(dx * dx + dy * dy + dz * dz));
+	}
+
+private:
+	std::vector<std::vector<float>*> arrays()
+	{
+		return { &centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ };
+	}
+};
+
+// Tests every object of a CullingSet against a frustum: a cheap sphere test, then the box
+// against each plane. Runs 8 objects per step with AVX, 4 with SSE2, otherwise scalar.
+// visible receives one byte per object; threads write disjoint ranges of it.
+class FrustumCuller
+{
+public:
+	static unsigned int cull(const CullingSet& set, const Frustum& frustum, std::vector<unsigned char>& visible, ThreadPool* pool = nullptr)
+	{
+		visible.resize(set.centerX.size());
+		size_t batches = set.centerX.size() / 8;
+		auto work = [&](size_t begin, size_t end)
+		{
+			cullRange(set, frustum, visible.data(), begin * 8, end * 8);
+		};
+		if (pool)
+		{
+			// Under ~16k objects the work is smaller than the cost of waking the workers
+			pool->parallelFor(batches, 2048, work);
+		}
+		else
+		{
+			work(0, batches);
+		}
+		visible.resize(set.count);
+		unsigned int visibleCount = 0;
+		for (unsigned int i = 0; i < set.count; i++)
+		{
+			visibleCount += visible[i];
+		}
+		return visibleCount;
+	}
+
+	// Scalar reference used by cullRange on targets without SSE2
+	static bool isVisible(const CullingSet& set, size_t i, const Frustum& frustum)
+	{
+		for (int p = 0; p < Frustum::PlaneCount; p++)
+		{
+			const float* plane = frustum.planes[p];
+			float d = plane[0] * set.centerX[i] + plane[1] * set.centerY[i] + plane[2] * set.centerZ[i] + plane[3];
+			if (d < -set.radius[i])
+			{
+				return false;
+			}
+			float reach = fabsf(plane[0]) * set.extentX[i] + fabsf(plane[1]) * set.extentY[i] + fabsf(plane[2]) * set.extentZ[i];
+			if (d + reach < 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	static void cullRange(const CullingSet& set, const Frustum& frustum, unsigned char* visible, size_t begin, size_t end)
+	{
+#if SIMD_AVX
+		for (size_t i = begin; i < end; i += 8)
+		{
+			__m256 cx = _mm256_loadu_ps(&set.centerX[i]);
+			__m256 cy = _mm256_loadu_ps(&set.centerY[i]);
+			__m256 cz = _mm256_loadu_ps(&set.centerZ[i]);
+			__m256 ex = _mm256_loadu_ps(&set.extentX[i]);
+			__m256 ey = _mm256_loadu_ps(&set.extentY[i]);
+			__m256 ez = _mm256_loadu_ps(&set.extentZ[i]);
+			__m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&set.radius[i]));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PlaneCount; p++)
+			{
+				const float* plane = frustum.planes[p];
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane[0])), _mm256_mul_ps(cy, _mm256_set1_ps(plane[1]))),
+					_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane[2])), _mm256_set1_ps(plane[3])));
+				__m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(fabsf(plane[0]))), _mm256_mul_ps(ey, _mm256_set1_ps(fabsf(plane[1])))),
+					_mm256_mul_ps(ez, _mm256_set1_ps(fabsf(plane[2]))));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			writeMask(visible + i, _mm256_movemask_ps(inside), 8);
+		}
+#elif SIMD_SSE2
+		for (size_t i = begin; i < end; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&set.centerX[i]);
+			__m128 cy = _mm_loadu_ps(&set.centerY[i]);
+			__m128 cz = _mm_loadu_ps(&set.centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&set.extentX[i]);
+			__m128 ey = _mm_loadu_ps(&set.extentY[i]);
+			__m128 ez = _mm_loadu_ps(&set.extentZ[i]);
+			__m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&set.radius[i]));
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PlaneCount; p++)
+			{
+				const float* plane = frustum.planes[p];
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane[0])), _mm_mul_ps(cy, _mm_set1_ps(plane[1]))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+				__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabsf(plane[0]))), _mm_mul_ps(ey, _mm_set1_ps(fabsf(plane[1])))),
+					_mm_mul_ps(ez, _mm_set1_ps(fabsf(plane[2]))));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, reach), _mm_setzero_ps()));
+			}
+			writeMask(visible + i, _mm_movemask_ps(inside), 4);
+		}
+#else
+		for (size_t i = begin; i < end; i++)
+		{
+			visible[i] = isVisible(set, i, frustum) ? 1 : 0;
+		}
+#endif
+	}
+
+	static void writeMask(unsigned char* visible, int mask, int lanes)
+	{
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			visible[lane] = static_cast<unsigned char>((mask >> lane) & 1);
+		}
+	}
+};
@@ -29,6 +29,8 @@ SOFTWARE.
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 
 namespace GEMLoader
 {
@@ -202,6 +204,24 @@ namespace GEMLoader
 	class GEMModelLoader
 	{
 	private:
+		std::streamoff fileSize = 0;
+		void measure(std::ifstream& file)
+		{
+			file.seekg(0, std::ios::end);
+			fileSize = file.tellg();
+			file.seekg(0, std::ios::beg);
+		}
+		// Bytes between the read position and the end of the file. Counts read from the file are
+		// capped by this, so a corrupt count cannot allocate more than the file could hold.
+		size_t bytesLeft(std::ifstream& file)
+		{
+			std::streamoff position = file.tellg();
+			if (!file || position < 0 || position >= fileSize)
+			{
+				return 0;
+			}
+			return static_cast<size_t>(fileSize - position);
+		}
 		GEMMaterialProperty loadProperty(std::ifstream& file)
 		{
 			GEMMaterialProperty prop;
@@ -209,52 +229,47 @@ namespace GEMLoader
 			prop.value = loadString(file);
 			return prop;
 		}
+		// Reads a count followed by that many elements with one sized read. If the file ends
+		// early only the elements that were read are kept.
+		template<typename T>
+		void loadArray(std::ifstream& file, std::vector<T>& values)
+		{
+			unsigned int n = 0;
+			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
+			if (!file)
+			{
+				return;
+			}
+			n = static_cast<unsigned int>((std::min)(static_cast<size_t>(n), bytesLeft(file) / sizeof(T)));
+			values.resize(n);
+			if (n > 0)
+			{
+				file.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(n) * sizeof(T));
+				values.resize(static_cast<size_t>(file.gcount()) / sizeof(T));
+			}
+		}
 		void loadMesh(std::ifstream& file, GEMMesh& mesh, int isAnimated)
 		{
 			unsigned int n = 0;
 			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-			for (unsigned int i = 0; i < n; i++)
+			for (unsigned int i = 0; i < n && file; i++)
 			{
 				mesh.material.properties.push_back(loadProperty(file));
 			}
 			if (isAnimated == 0)
 			{
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					GEMStaticVertex v;
-					file.read(reinterpret_cast<char*>(&v), sizeof(GEMStaticVertex));
-					mesh.verticesStatic.push_back(v);
-				}
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					unsigned int index = 0;
-					file.read(reinterpret_cast<char*>(&index), sizeof(unsigned int));
-					mesh.indices.push_back(index);
-				}
+				loadArray(file, mesh.verticesStatic);
 			} else
 			{
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					GEMAnimatedVertex v;
-					file.read(reinterpret_cast<char*>(&v), sizeof(GEMAnimatedVertex));
-					mesh.verticesAnimated.push_back(v);
-				}
-				file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-				for (unsigned int i = 0; i < n; i++)
-				{
-					unsigned int index = 0;
-					file.read(reinterpret_cast<char*>(&index), sizeof(unsigned int));
-					mesh.indices.push_back(index);
-				}
+				loadArray(file, mesh.verticesAnimated);
 			}
+			loadArray(file, mesh.indices);
 		}
 		std::string loadString(std::ifstream& file)
 		{
 			int l = 0;
 			file.read(reinterpret_cast<char*>(&l), sizeof(int));
+			l = static_cast<int>((std::min)(static_cast<size_t>((std::max)(l, 0)), bytesLeft(file)));
 			char* buffer = new char[l + 1];
 			memset(buffer, 0, l * sizeof(char));
 			file.read(buffer, l * sizeof(char));
@@ -283,27 +298,27 @@ namespace GEMLoader
 		}
 		void loadFrame(GEMAnimationSequence& aseq, std::ifstream& file, int bonesN)
 		{
-			GEMAnimationFrame frame;
-			for (int i = 0; i < bonesN; i++)
+			aseq.frames.emplace_back();
+			GEMAnimationFrame& frame = aseq.frames.back();
+			if (bonesN <= 0)
 			{
-				GEMVec3 p = loadVec3(file);
-				frame.positions.push_back(p);
+				return;
 			}
-			for (int i = 0; i < bonesN; i++)
-			{
-				GEMQuaternion q = loadQuaternion(file);
-				frame.rotations.push_back(q);
-			}
-			for (int i = 0; i < bonesN; i++)
-			{
-				GEMVec3 s = loadVec3(file);
-				frame.scales.push_back(s);
-			}
-			aseq.frames.push_back(frame);
+			frame.positions.resize(bonesN);
+			frame.rotations.resize(bonesN);
+			frame.scales.resize(bonesN);
+			file.read(reinterpret_cast<char*>(frame.positions.data()), static_cast<std::streamsize>(bonesN) * sizeof(GEMVec3));
+			file.read(reinterpret_cast<char*>(frame.rotations.data()), static_cast<std::streamsize>(bonesN) * sizeof(GEMQuaternion));
+			file.read(reinterpret_cast<char*>(frame.scales.data()), static_cast<std::streamsize>(bonesN) * sizeof(GEMVec3));
 		}
 		void loadFrames(GEMAnimationSequence& aseq, std::ifstream& file, int bonesN, int frames)
 		{
-			for (int i = 0; i < frames; i++)
+			if (bonesN > 0)
+			{
+				size_t frameBytes = static_cast<size_t>(bonesN) * (2 * sizeof(GEMVec3) + sizeof(GEMQuaternion));
+				aseq.frames.reserve((std::min)(static_cast<size_t>((std::max)(frames, 0)), bytesLeft(file) / frameBytes));
+			}
+			for (int i = 0; i < frames && file; i++)
 			{
 				loadFrame(aseq, file, bonesN);
 			}
@@ -328,6 +343,7 @@ namespace GEMLoader
 		void load(std::string filename, std::vector<GEMMesh>& meshes)
 		{
 			std::ifstream file(filename, ::std::ios::binary);
+			measure(file);
 			unsigned int n = 0;
 			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
 			if (n != 4058972161)
@@ -339,17 +355,19 @@ namespace GEMLoader
 			unsigned int isAnimated = 0;
 			file.read(reinterpret_cast<char*>(&isAnimated), sizeof(unsigned int));
 			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-			for (unsigned int i = 0; i < n; i++)
+			// Every mesh takes at least its three counts
+			meshes.reserve(meshes.size() + (std::min)(static_cast<size_t>(n), bytesLeft(file) / (3 * sizeof(unsigned int))));
+			for (unsigned int i = 0; i < n && file; i++)
 			{
-				GEMMesh mesh;
-				loadMesh(file, mesh, isAnimated);
-				meshes.push_back(mesh);
+				meshes.emplace_back();
+				loadMesh(file, meshes.back(), isAnimated);
 			}
 			file.close();
 		}
 		void load(std::string filename, std::vector<GEMMesh>& meshes, GEMAnimation& animation)
 		{
 			std::ifstream file(filename, ::std::ios::binary);
+			measure(file);
 			unsigned int n = 0;
 			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
 			if (n != 4058972161)
@@ -360,16 +378,17 @@ namespace GEMLoader
 			unsigned int isAnimated = 0;
 			file.read(reinterpret_cast<char*>(&isAnimated), sizeof(unsigned int));
 			file.read(reinterpret_cast<char*>(&n), sizeof(unsigned int));
-			for (unsigned int i = 0; i < n; i++)
+			// Every mesh takes at least its three counts
+			meshes.reserve(meshes.size() + (std::min)(static_cast<size_t>(n), bytesLeft(file) / (3 * sizeof(unsigned int))));
+			for (unsigned int i = 0; i < n && file; i++)
 			{
-				GEMMesh mesh;
-				loadMesh(file, mesh, isAnimated);
-				meshes.push_back(mesh);
+				meshes.emplace_back();
+				loadMesh(file, meshes.back(), isAnimated);
 			}
 			// Read skeleton
 			unsigned int bonesN = 0;
 			file.read(reinterpret_cast<char*>(&bonesN), sizeof(unsigned int));
-			for (unsigned int i = 0; i < bonesN; i++)
+			for (unsigned int i = 0; i < bonesN && file; i++)
 			{
 				GEMBone bone;
 				bone.name = loadString(file);
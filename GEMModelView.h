@@ -0,0 +1,343 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "GEMLoader.h"
+
+namespace GEMLoader
+{
+
+	// Read-only view of count elements, always correctly aligned for T. The file packs arrays
+	// after variable length strings, so an array inside the mapping may be misaligned; such an
+	// array is copied into storage owned by the GEMModelView instead of being read in place.
+	// bytes always points at the array inside the mapping, for consumers that only copy the
+	// data onwards (e.g. a GPU upload) and so never need the aligned copy.
+	template<typename T>
+	class GEMSpan
+	{
+	public:
+		const T* data = nullptr;
+		const unsigned char* bytes = nullptr;
+		size_t count = 0;
+
+		size_t size() const
+		{
+			return count;
+		}
+		bool empty() const
+		{
+			return count == 0;
+		}
+		size_t sizeInBytes() const
+		{
+			return count * sizeof(T);
+		}
+		const T& operator[](size_t i) const
+		{
+			return data[i];
+		}
+		const T* begin() const
+		{
+			return data;
+		}
+		const T* end() const
+		{
+			return data + count;
+		}
+		std::vector<T> toVector() const
+		{
+			return std::vector<T>(begin(), end());
+		}
+	};
+
+	class GEMMeshView
+	{
+	public:
+		GEMMaterial material;
+		GEMSpan<GEMStaticVertex> verticesStatic;
+		GEMSpan<GEMAnimatedVertex> verticesAnimated;
+		GEMSpan<unsigned int> indices;
+
+		bool isAnimated() const
+		{
+			return !verticesAnimated.empty();
+		}
+
+		// Copies into the owning type for code that needs to modify the mesh
+		GEMMesh toMesh() const
+		{
+			GEMMesh mesh;
+			mesh.material = material;
+			mesh.verticesStatic = verticesStatic.toVector();
+			mesh.verticesAnimated = verticesAnimated.toVector();
+			mesh.indices = indices.toVector();
+			return mesh;
+		}
+	};
+
+	// Maps a GEM file and parses its header and mesh table once. Vertex and index spans point
+	// straight into the mapping, or into an aligned copy where the mapping is misaligned, and
+	// stay valid until close() or destruction.
+	// Every count and length is checked against the file size; a truncated or corrupt file
+	// throws std::runtime_error instead of reading past the end.
+	class GEMModelView
+	{
+	public:
+		std::vector<GEMMeshView> meshes;
+		bool animated = false;
+		// Bytes copied out of the mapping because an array was not aligned for its type
+		size_t bytesCopied = 0;
+
+		GEMModelView() = default;
+		GEMModelView(const GEMModelView&) = delete;
+		GEMModelView& operator=(const GEMModelView&) = delete;
+		~GEMModelView()
+		{
+			close();
+		}
+
+		void open(const std::string& filename)
+		{
+			close();
+			map(filename);
+			try
+			{
+				parse(filename);
+			}
+			catch (...)
+			{
+				close();
+				throw;
+			}
+		}
+
+		void close()
+		{
+			meshes.clear();
+			copies.clear();
+			bytesCopied = 0;
+#ifdef _WIN32
+			if (bytes)
+			{
+				UnmapViewOfFile(bytes);
+			}
+			if (mapping)
+			{
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (bytes)
+			{
+				munmap(const_cast<unsigned char*>(bytes), size);
+			}
+#endif
+			bytes = nullptr;
+			size = 0;
+		}
+
+		const unsigned char* data() const
+		{
+			return bytes;
+		}
+		size_t fileSize() const
+		{
+			return size;
+		}
+
+	private:
+		const unsigned char* bytes = nullptr;
+		size_t size = 0;
+		// Aligned copies of misaligned arrays, new[] storage is aligned for any fundamental type
+		std::vector<std::unique_ptr<unsigned char[]>> copies;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#endif
+
+		void map(const std::string& filename)
+		{
+#ifdef _WIN32
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				throw std::runtime_error("Failed to open " + filename);
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize))
+			{
+				close();
+				throw std::runtime_error("Failed to get the size of " + filename);
+			}
+			size = static_cast<size_t>(fileSize.QuadPart);
+			if (size == 0)
+			{
+				return;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (!mapping)
+			{
+				close();
+				throw std::runtime_error("Failed to map " + filename);
+			}
+			bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!bytes)
+			{
+				close();
+				throw std::runtime_error("Failed to map " + filename);
+			}
+#else
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				throw std::runtime_error("Failed to open " + filename);
+			}
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("Failed to get the size of " + filename);
+			}
+			size = static_cast<size_t>(info.st_size);
+			if (size == 0)
+			{
+				::close(fd);
+				return;
+			}
+			void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			// The mapping keeps its own reference to the file
+			::close(fd);
+			if (address == MAP_FAILED)
+			{
+				size = 0;
+				throw std::runtime_error("Failed to map " + filename);
+			}
+			bytes = static_cast<const unsigned char*>(address);
+#endif
+		}
+
+		// Bounds-checked reader over the mapping
+		struct Cursor
+		{
+			const unsigned char* bytes;
+			size_t size;
+			size_t offset;
+			const std::string& filename;
+			GEMModelView& view;
+
+			void require(size_t count)
+			{
+				if (count > size - offset)
+				{
+					throw std::runtime_error(filename + " is truncated or corrupt");
+				}
+			}
+			unsigned int readUInt()
+			{
+				unsigned int value = 0;
+				require(sizeof(value));
+				memcpy(&value, bytes + offset, sizeof(value));
+				offset += sizeof(value);
+				return value;
+			}
+			std::string readString()
+			{
+				int length = static_cast<int>(readUInt());
+				if (length < 0)
+				{
+					throw std::runtime_error(filename + " is truncated or corrupt");
+				}
+				require(static_cast<size_t>(length));
+				// Stops at an embedded 0 like GEMModelLoader::loadString
+				std::string value(reinterpret_cast<const char*>(bytes + offset), strnlen(reinterpret_cast<const char*>(bytes + offset), static_cast<size_t>(length)));
+				offset += static_cast<size_t>(length);
+				return value;
+			}
+			template<typename T>
+			GEMSpan<T> readSpan()
+			{
+				size_t count = readUInt();
+				// Divide rather than multiply so a huge count cannot overflow the check
+				if (count > (size - offset) / sizeof(T))
+				{
+					throw std::runtime_error(filename + " is truncated or corrupt");
+				}
+				GEMSpan<T> span;
+				span.count = count;
+				const unsigned char* source = bytes + offset;
+				span.bytes = source;
+				if (reinterpret_cast<std::uintptr_t>(source) % alignof(T) == 0)
+				{
+					span.data = reinterpret_cast<const T*>(source);
+				} else if (count > 0)
+				{
+					std::unique_ptr<unsigned char[]> copy(new unsigned char[count * sizeof(T)]);
+					memcpy(copy.get(), source, count * sizeof(T));
+					span.data = reinterpret_cast<const T*>(copy.get());
+					view.copies.push_back(std::move(copy));
+					view.bytesCopied += count * sizeof(T);
+				}
+				offset += count * sizeof(T);
+				return span;
+			}
+		};
+
+		void parse(const std::string& filename)
+		{
+			Cursor cursor = { bytes, size, 0, filename, *this };
+			if (size < sizeof(unsigned int) || cursor.readUInt() != 4058972161)
+			{
+				throw std::runtime_error(filename + " is not a GE Model File");
+			}
+			animated = cursor.readUInt() != 0;
+			unsigned int meshCount = cursor.readUInt();
+			// Each mesh needs at least its three counts
+			if (meshCount > (size - cursor.offset) / (3 * sizeof(unsigned int)))
+			{
+				throw std::runtime_error(filename + " is truncated or corrupt");
+			}
+			meshes.resize(meshCount);
+			for (unsigned int i = 0; i < meshCount; i++)
+			{
+				GEMMeshView& mesh = meshes[i];
+				unsigned int propertyCount = cursor.readUInt();
+				for (unsigned int p = 0; p < propertyCount; p++)
+				{
+					GEMMaterialProperty property;
+					property.name = cursor.readString();
+					property.value = cursor.readString();
+					mesh.material.properties.push_back(property);
+				}
+				if (animated)
+				{
+					mesh.verticesAnimated = cursor.readSpan<GEMAnimatedVertex>();
+				}
+				else
+				{
+					mesh.verticesStatic = cursor.readSpan<GEMStaticVertex>();
+				}
+				mesh.indices = cursor.readSpan<unsigned int>();
+			}
+		}
+	};
+
+};
@@ -1,9 +1,22 @@
 ﻿#include "window.h"
 #include "Core.h"
+#include "ShaderHotReload.h"
 #include "Mash.h"
 #include "Shader.h"
 #include "ShaderPeflection.h"
 
+// 常量缓冲区布局，由 C++ 结构体描述并在编译期检查 HLSL 打包规则
+struct MatrixBuffer {
+    float world[4][4]; // 世界矩阵
+    float view[4][4];  // 视图矩阵
+    float proj[4][4];  // 投影矩阵
+};
+
+CONSTANT_BUFFER_LAYOUT(MatrixBuffer,
+    CONSTANT_BUFFER_FIELD(MatrixBuffer, world),
+    CONSTANT_BUFFER_FIELD(MatrixBuffer, view),
+    CONSTANT_BUFFER_FIELD(MatrixBuffer, proj));
+
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nCmdShow) {
     // 创建窗口
     Window win;
@@ -29,19 +42,18 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     std::string vsCode = shader.loadShaderCode("VStri.txt");
     std::string psCode = shader.loadShaderCode("PStri.txt");
 
-    shader.loadVS(&core, vsCode, &Shader::XInputLayout);
+    shader.loadVS(&core, vsCode, &Shader::inputLayout<Vertex>);
     shader.loadPS(&core, psCode);
 
-    // 添加常量缓冲区
-    struct MatrixBuffer {
-        float world[4][4]; // 世界矩阵
-        float view[4][4];  // 视图矩阵
-        float proj[4][4];  // 投影矩阵
-    };
+    // 修改着色器文件后自动重新编译
+    ShaderHotReload hotReload;
+    hotReload.watch(&shader, "VStri.txt", "PStri.txt");
+    hotReload.start();
 
+    // 添加常量缓冲区
     MatrixBuffer matrixData;
-    ConstantBuffer matrixBuffer;
-    matrixBuffer.init(&core, sizeof(MatrixBuffer), 0, ShaderStage::VertexShader);
+    TypedConstantBuffer<MatrixBuffer> matrixBuffer;
+    matrixBuffer.init(&core, 0, ShaderStage::VertexShader);
 
     // 设置默认矩阵数据（单位矩阵）
     memset(&matrixData, 0, sizeof(MatrixBuffer));
@@ -64,10 +76,11 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
         // 更新逻辑（可以扩展）
         // 这里可以动态更新 `matrixData.world` 等数据
 
+        // 在帧之间替换重新编译好的着色器
+        hotReload.applyPendingReloads(&core);
+
         // 上传矩阵数据到常量缓冲区
-        matrixBuffer.update("world", &matrixData.world);
-        matrixBuffer.update("view", &matrixData.view);
-        matrixBuffer.update("proj", &matrixData.proj);
+        matrixBuffer.update(matrixData);
         matrixBuffer.upload(&core);
 
         // 渲染
@@ -78,8 +91,11 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     }
 
     // 释放资源
+    hotReload.stop();
     triangle.vertexBuffer->Release();
     shader.release();
+    core.inputLayouts.release();
+    core.states.release();
     matrixBuffer.free();
 
     return 0;
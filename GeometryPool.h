@@ -0,0 +1,322 @@
+#pragma once
+
+#include <d3d11.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Core.h"
+#include "GEMLoader.h"
+#include "GeometryPoolAllocator.h"
+
+// Where one mesh lives inside the pool's shared buffers, ready for DrawIndexed
+struct GeometryRange
+{
+	unsigned int baseVertex = 0;
+	unsigned int vertexCount = 0;
+	unsigned int firstIndex = 0;
+	unsigned int indexCount = 0;
+};
+
+typedef unsigned int GeometryHandle;
+
+// Suballocates the vertices and indices of many meshes that share a vertex format into one
+// vertex buffer and one index buffer, so every draw from the pool uses a single
+// IASetVertexBuffers/IASetIndexBuffer binding. Indices stay local to their mesh and are
+// offset by baseVertex at draw time, so 16-bit indices work for any pool size as long as each
+// mesh has at most 65536 vertices. Handles stay valid across growth and compaction.
+class GeometryPool
+{
+public:
+	ID3D11Buffer* vertexBuffer = nullptr;
+	ID3D11Buffer* indexBuffer = nullptr;
+	unsigned int vertexStride = 0;
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
+	GeometryPoolAllocator vertices;
+	GeometryPoolAllocator indices;
+	std::vector<GeometryRange> ranges;
+	std::vector<bool> live;
+	std::vector<GeometryHandle> freeHandles;
+	unsigned int compactions = 0;
+
+	void init(Core* core, unsigned int stride, unsigned int vertexCapacity, unsigned int indexCapacity, DXGI_FORMAT format = DXGI_FORMAT_R32_UINT)
+	{
+		if (format != DXGI_FORMAT_R16_UINT && format != DXGI_FORMAT_R32_UINT)
+		{
+			throw std::runtime_error("Geometry pool index format must be R16_UINT or R32_UINT.");
+		}
+		vertexStride = stride;
+		indexFormat = format;
+		vertices.init(vertexCapacity);
+		indices.init(indexCapacity);
+		vertexBuffer = createBuffer(core, vertexCapacity * vertexStride, D3D11_BIND_VERTEX_BUFFER);
+		indexBuffer = createBuffer(core, indexCapacity * indexSize(), D3D11_BIND_INDEX_BUFFER);
+	}
+
+	// Copies a mesh into the pool, growing or compacting the buffers if there is no room
+	GeometryHandle add(Core* core, const void* vertexData, unsigned int vertexCount, const unsigned int* indexData, unsigned int indexCount)
+	{
+		std::vector<unsigned short> indices16;
+		const void* indexUpload = indexData;
+		if (indexFormat == DXGI_FORMAT_R16_UINT)
+		{
+			indices16.resize(indexCount);
+			for (unsigned int i = 0; i < indexCount; i++)
+			{
+				if (indexData[i] > 0xFFFF)
+				{
+					throw std::runtime_error("Mesh has too many vertices for a 16-bit geometry pool.");
+				}
+				indices16[i] = static_cast<unsigned short>(indexData[i]);
+			}
+			indexUpload = indices16.data();
+		}
+
+		GeometryRange range;
+		range.vertexCount = vertexCount;
+		range.indexCount = indexCount;
+		if (!tryAllocate(range))
+		{
+			// Compacting is enough when the free space is only split up, otherwise double
+			unsigned int vertexCapacity = vertices.capacity;
+			unsigned int indexCapacity = indices.capacity;
+			while (vertexCapacity - vertices.used < vertexCount)
+			{
+				vertexCapacity = (std::max)(vertexCapacity * 2, 1024u);
+			}
+			while (indexCapacity - indices.used < indexCount)
+			{
+				indexCapacity = (std::max)(indexCapacity * 2, 1024u);
+			}
+			compact(core, vertexCapacity, indexCapacity);
+			if (!tryAllocate(range))
+			{
+				throw std::runtime_error("Geometry pool allocation failed after compaction.");
+			}
+		}
+
+		D3D11_BOX vertexBox = { range.baseVertex * vertexStride, 0, 0, (range.baseVertex + vertexCount) * vertexStride, 1, 1 };
+		D3D11_BOX indexBox = { range.firstIndex * indexSize(), 0, 0, (range.firstIndex + indexCount) * indexSize(), 1, 1 };
+		if (vertexCount > 0)
+		{
+			core->deviceContext->UpdateSubresource(vertexBuffer, 0, &vertexBox, vertexData, 0, 0);
+		}
+		if (indexCount > 0)
+		{
+			core->deviceContext->UpdateSubresource(indexBuffer, 0, &indexBox, indexUpload, 0, 0);
+		}
+
+		GeometryHandle handle;
+		if (!freeHandles.empty())
+		{
+			handle = freeHandles.back();
+			freeHandles.pop_back();
+			ranges[handle] = range;
+			live[handle] = true;
+		}
+		else
+		{
+			handle = static_cast<GeometryHandle>(ranges.size());
+			ranges.push_back(range);
+			live.push_back(true);
+		}
+		return handle;
+	}
+
+	template<typename Vertex>
+	GeometryHandle add(Core* core, const std::vector<Vertex>& vertexData, const std::vector<unsigned int>& indexData)
+	{
+		if (sizeof(Vertex) != vertexStride)
+		{
+			throw std::runtime_error("Vertex size does not match the geometry pool stride.");
+		}
+		return add(core, vertexData.data(), static_cast<unsigned int>(vertexData.size()), indexData.data(), static_cast<unsigned int>(indexData.size()));
+	}
+
+	GeometryHandle add(Core* core, const GEMLoader::GEMMesh& mesh)
+	{
+		if (!mesh.verticesAnimated.empty())
+		{
+			return add(core, mesh.verticesAnimated, mesh.indices);
+		}
+		return add(core, mesh.verticesStatic, mesh.indices);
+	}
+
+	// The space is reused by later meshes; call compact() to close the gaps
+	void remove(GeometryHandle handle)
+	{
+		if (handle >= ranges.size() || !live[handle])
+		{
+			return;
+		}
+		vertices.free(ranges[handle].baseVertex, ranges[handle].vertexCount);
+		indices.free(ranges[handle].firstIndex, ranges[handle].indexCount);
+		live[handle] = false;
+		ranges[handle] = GeometryRange();
+		freeHandles.push_back(handle);
+	}
+
+	const GeometryRange& range(GeometryHandle handle) const
+	{
+		return ranges[handle];
+	}
+
+	// Moves every live mesh to the front of new buffers of the given capacity, leaving one free
+	// block at the end of each. The copies run on the GPU; no CPU copy of the geometry is kept.
+	void compact(Core* core, unsigned int vertexCapacity, unsigned int indexCapacity)
+	{
+		if (vertexCapacity < vertices.used || indexCapacity < indices.used)
+		{
+			throw std::runtime_error("Geometry pool cannot be compacted below the space its meshes use.");
+		}
+		ID3D11Buffer* newVertexBuffer = createBuffer(core, vertexCapacity * vertexStride, D3D11_BIND_VERTEX_BUFFER);
+		ID3D11Buffer* newIndexBuffer = createBuffer(core, indexCapacity * indexSize(), D3D11_BIND_INDEX_BUFFER);
+		// Keep the current order so neighbouring meshes stay neighbours
+		std::vector<GeometryHandle> order;
+		for (GeometryHandle h = 0; h < ranges.size(); h++)
+		{
+			if (live[h])
+			{
+				order.push_back(h);
+			}
+		}
+		std::vector<GeometryRange> moved = ranges;
+		std::sort(order.begin(), order.end(), [this](GeometryHandle a, GeometryHandle b) { return ranges[a].baseVertex < ranges[b].baseVertex; });
+		unsigned int vertexCursor = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			GeometryRange& r = moved[order[i]];
+			copyRegion(core, newVertexBuffer, vertexBuffer, vertexCursor * vertexStride, r.baseVertex * vertexStride, r.vertexCount * vertexStride);
+			r.baseVertex = vertexCursor;
+			vertexCursor += r.vertexCount;
+		}
+		std::sort(order.begin(), order.end(), [this](GeometryHandle a, GeometryHandle b) { return ranges[a].firstIndex < ranges[b].firstIndex; });
+		unsigned int indexCursor = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			GeometryRange& r = moved[order[i]];
+			copyRegion(core, newIndexBuffer, indexBuffer, indexCursor * indexSize(), r.firstIndex * indexSize(), r.indexCount * indexSize());
+			r.firstIndex = indexCursor;
+			indexCursor += r.indexCount;
+		}
+		// The live meshes now fill the front of each buffer, the rest is one free block
+		GeometryPoolAllocator newVertices;
+		GeometryPoolAllocator newIndices;
+		newVertices.init(vertexCapacity);
+		newIndices.init(indexCapacity);
+		unsigned int offset = 0;
+		if (!newVertices.allocate(vertexCursor, offset) || !newIndices.allocate(indexCursor, offset))
+		{
+			newVertexBuffer->Release();
+			newIndexBuffer->Release();
+			throw std::runtime_error("Geometry pool compaction could not place the live meshes.");
+		}
+		vertexBuffer->Release();
+		indexBuffer->Release();
+		vertexBuffer = newVertexBuffer;
+		indexBuffer = newIndexBuffer;
+		ranges = moved;
+		vertices = newVertices;
+		indices = newIndices;
+		compactions++;
+	}
+
+	void compact(Core* core)
+	{
+		compact(core, vertices.capacity, indices.capacity);
+	}
+
+	GeometryPoolReport report() const
+	{
+		unsigned int meshes = 0;
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			meshes += live[i] ? 1 : 0;
+		}
+		return GeometryPoolReport::describe(meshes, vertices, indices);
+	}
+
+	// One binding for every mesh in the pool
+	void bind(ID3D11DeviceContext* devicecontext)
+	{
+		UINT offsets = 0;
+		UINT strides = vertexStride;
+		devicecontext->IASetVertexBuffers(0, 1, &vertexBuffer, &strides, &offsets);
+		devicecontext->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+		devicecontext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	}
+
+	void draw(ID3D11DeviceContext* devicecontext, GeometryHandle handle)
+	{
+		const GeometryRange& r = ranges[handle];
+		devicecontext->DrawIndexed(r.indexCount, r.firstIndex, static_cast<int>(r.baseVertex));
+	}
+
+	void drawInstanced(ID3D11DeviceContext* devicecontext, GeometryHandle handle, unsigned int instanceCount, unsigned int firstInstance = 0)
+	{
+		const GeometryRange& r = ranges[handle];
+		devicecontext->DrawIndexedInstanced(r.indexCount, instanceCount, r.firstIndex, static_cast<int>(r.baseVertex), firstInstance);
+	}
+
+	void release()
+	{
+		if (vertexBuffer)
+		{
+			vertexBuffer->Release();
+		}
+		if (indexBuffer)
+		{
+			indexBuffer->Release();
+		}
+		vertexBuffer = nullptr;
+		indexBuffer = nullptr;
+		ranges.clear();
+		live.clear();
+		freeHandles.clear();
+	}
+
+private:
+	bool tryAllocate(GeometryRange& range)
+	{
+		if (!vertices.allocate(range.vertexCount, range.baseVertex))
+		{
+			return false;
+		}
+		if (!indices.allocate(range.indexCount, range.firstIndex))
+		{
+			vertices.free(range.baseVertex, range.vertexCount);
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int indexSize() const
+	{
+		return indexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4;
+	}
+
+	static ID3D11Buffer* createBuffer(Core* core, unsigned int byteWidth, UINT bindFlags)
+	{
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DEFAULT;
+		// Empty buffers are not allowed, round up so an empty pool can still be created
+		bd.ByteWidth = (std::max)((byteWidth + 3) & ~3u, 4u);
+		bd.BindFlags = bindFlags;
+		ID3D11Buffer* buffer = nullptr;
+		if (FAILED(core->device->CreateBuffer(&bd, NULL, &buffer)))
+		{
+			throw std::runtime_error("Failed to create geometry pool buffer.");
+		}
+		return buffer;
+	}
+
+	static void copyRegion(Core* core, ID3D11Buffer* destination, ID3D11Buffer* source, unsigned int destinationOffset, unsigned int sourceOffset, unsigned int size)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		D3D11_BOX box = { sourceOffset, 0, 0, sourceOffset + size, 1, 1 };
+		core->deviceContext->CopySubresourceRegion(destination, 0, destinationOffset, 0, 0, source, 0, &box);
+	}
+};
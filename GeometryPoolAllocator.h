@@ -0,0 +1,122 @@
+#pragma once
+
+#include <map>
+#include <iterator>
+#include <algorithm>
+
+// First-fit allocator over a range of elements (vertices or indices). Holds no D3D objects.
+// Free blocks are kept sorted by offset and merged with their neighbours when freed.
+class GeometryPoolAllocator
+{
+public:
+	unsigned int capacity = 0;
+	unsigned int used = 0;
+	std::map<unsigned int, unsigned int> freeBlocks; // offset -> size
+
+	void init(unsigned int capacityInElements)
+	{
+		capacity = capacityInElements;
+		used = 0;
+		freeBlocks.clear();
+		if (capacity > 0)
+		{
+			freeBlocks[0] = capacity;
+		}
+	}
+
+	bool allocate(unsigned int count, unsigned int& offset)
+	{
+		if (count == 0)
+		{
+			offset = 0;
+			return true;
+		}
+		for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+		{
+			if (it->second >= count)
+			{
+				offset = it->first;
+				unsigned int remaining = it->second - count;
+				freeBlocks.erase(it);
+				if (remaining > 0)
+				{
+					freeBlocks[offset + count] = remaining;
+				}
+				used += count;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void free(unsigned int offset, unsigned int count)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		used -= count;
+		auto next = freeBlocks.lower_bound(offset);
+		if (next != freeBlocks.begin())
+		{
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				offset = previous->first;
+				count += previous->second;
+				freeBlocks.erase(previous);
+			}
+		}
+		if (next != freeBlocks.end() && offset + count == next->first)
+		{
+			count += next->second;
+			freeBlocks.erase(next);
+		}
+		freeBlocks[offset] = count;
+	}
+
+	unsigned int largestFreeBlock() const
+	{
+		unsigned int largest = 0;
+		for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+		{
+			largest = (std::max)(largest, it->second);
+		}
+		return largest;
+	}
+};
+
+struct GeometryPoolReport
+{
+	unsigned int meshes = 0;
+	unsigned int vertexCapacity = 0;
+	unsigned int verticesUsed = 0;
+	unsigned int vertexFreeBlocks = 0;
+	unsigned int largestFreeVertexBlock = 0;
+	unsigned int indexCapacity = 0;
+	unsigned int indicesUsed = 0;
+	unsigned int indexFreeBlocks = 0;
+	unsigned int largestFreeIndexBlock = 0;
+	// 0 when all free space is one block, approaching 1 as it splinters
+	float vertexFragmentation = 0.0f;
+	float indexFragmentation = 0.0f;
+
+	static GeometryPoolReport describe(unsigned int meshes, const GeometryPoolAllocator& vertices, const GeometryPoolAllocator& indices)
+	{
+		GeometryPoolReport r;
+		r.meshes = meshes;
+		r.vertexCapacity = vertices.capacity;
+		r.verticesUsed = vertices.used;
+		r.vertexFreeBlocks = static_cast<unsigned int>(vertices.freeBlocks.size());
+		r.largestFreeVertexBlock = vertices.largestFreeBlock();
+		r.indexCapacity = indices.capacity;
+		r.indicesUsed = indices.used;
+		r.indexFreeBlocks = static_cast<unsigned int>(indices.freeBlocks.size());
+		r.largestFreeIndexBlock = indices.largestFreeBlock();
+		unsigned int freeVertices = vertices.capacity - vertices.used;
+		unsigned int freeIndices = indices.capacity - indices.used;
+		r.vertexFragmentation = freeVertices > 0 ? 1.0f - static_cast<float>(r.largestFreeVertexBlock) / freeVertices : 0.0f;
+		r.indexFragmentation = freeIndices > 0 ? 1.0f - static_cast<float>(r.largestFreeIndexBlock) / freeIndices : 0.0f;
+		return r;
+	}
+};
@@ -4,14 +4,34 @@
 #include <d3dcompiler.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <functional>
 #include <windows.h>
 #include "Shader.h"
+#include "VertexFormat.h"
+#include "GEMLoader.h"
+#include "GEMModelView.h"
+#include "VertexCompression.h"
+#include "Meshlets.h"
+#include "MeshSimplifier.h"
+#include "RenderQueue.h"
+#include "FrustumCulling.h"
 #include "Matrix.h"
 
+// 顶点字段类型对应的 DXGI 格式
+template<> struct VertexElementFormat<Vec3> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32_FLOAT, 12> {};
+template<> struct VertexElementFormat<Colour> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32A32_FLOAT, 16> {};
+template<> struct VertexElementFormat<GEMLoader::GEMVec3> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32_FLOAT, 12> {};
+template<> struct VertexElementFormat<PackedUnorm16x4> : VertexElementFormatOf<DXGI_FORMAT_R16G16B16A16_UNORM, 8> {};
+template<> struct VertexElementFormat<PackedSnorm16x2> : VertexElementFormatOf<DXGI_FORMAT_R16G16_SNORM, 4> {};
+template<> struct VertexElementFormat<PackedHalf2> : VertexElementFormatOf<DXGI_FORMAT_R16G16_FLOAT, 4> {};
+template<> struct VertexElementFormat<PackedUInt8x4> : VertexElementFormatOf<DXGI_FORMAT_R8G8B8A8_UINT, 4> {};
+template<> struct VertexElementFormat<PackedUnorm8x4> : VertexElementFormatOf<DXGI_FORMAT_R8G8B8A8_UNORM, 4> {};
 
 struct Vertex
 {
@@ -19,10 +39,64 @@ struct Vertex
     Colour colour;
 };
 
+VERTEX_FORMAT(Vertex,
+    VERTEX_ELEMENT(Vertex, position, "POS", 0),
+    VERTEX_ELEMENT(Vertex, colour, "COLOUR", 0));
+
+VERTEX_FORMAT(GEMLoader::GEMStaticVertex,
+    VERTEX_ELEMENT(GEMLoader::GEMStaticVertex, position, "POS", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMStaticVertex, normal, "NORMAL", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMStaticVertex, tangent, "TANGENT", 0),
+    VERTEX_ELEMENT_AS(GEMLoader::GEMStaticVertex, u, float[2], "TEXCOORD", 0));
+
+VERTEX_FORMAT(GEMLoader::GEMAnimatedVertex,
+    VERTEX_ELEMENT(GEMLoader::GEMAnimatedVertex, position, "POS", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMAnimatedVertex, normal, "NORMAL", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMAnimatedVertex, tangent, "TANGENT", 0),
+    VERTEX_ELEMENT_AS(GEMLoader::GEMAnimatedVertex, u, float[2], "TEXCOORD", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMAnimatedVertex, bonesIDs, "BONEIDS", 0),
+    VERTEX_ELEMENT(GEMLoader::GEMAnimatedVertex, boneWeights, "BONEWEIGHTS", 0));
+
+// 压缩顶点：语义与未压缩格式相同，顶点着色器需要解码位置和八面体法线（见 VertexCompression.h）
+VERTEX_FORMAT(CompressedStaticVertex,
+    VERTEX_ELEMENT(CompressedStaticVertex, position, "POS", 0),
+    VERTEX_ELEMENT(CompressedStaticVertex, normal, "NORMAL", 0),
+    VERTEX_ELEMENT(CompressedStaticVertex, tangent, "TANGENT", 0),
+    VERTEX_ELEMENT(CompressedStaticVertex, uv, "TEXCOORD", 0));
+
+VERTEX_FORMAT(CompressedAnimatedVertex,
+    VERTEX_ELEMENT(CompressedAnimatedVertex, position, "POS", 0),
+    VERTEX_ELEMENT(CompressedAnimatedVertex, normal, "NORMAL", 0),
+    VERTEX_ELEMENT(CompressedAnimatedVertex, tangent, "TANGENT", 0),
+    VERTEX_ELEMENT(CompressedAnimatedVertex, uv, "TEXCOORD", 0),
+    VERTEX_ELEMENT(CompressedAnimatedVertex, bonesIDs, "BONEIDS", 0),
+    VERTEX_ELEMENT(CompressedAnimatedVertex, boneWeights, "BONEWEIGHTS", 0));
+
+// 每实例数据：世界矩阵的前三行。Matrix 为行主序、平移在第 4 列，最后一行总是 (0, 0, 0, 1)，
+// 因此 48 字节即可表示完整变换。顶点着色器中 worldPos = float3(dot(WORLD0, p), dot(WORLD1, p), dot(WORLD2, p))，p = float4(pos, 1)
+struct InstanceTransform
+{
+    float row0[4];
+    float row1[4];
+    float row2[4];
+
+    static InstanceTransform fromMatrix(const Matrix& world) {
+        InstanceTransform t;
+        memcpy(&t, world.m, sizeof(InstanceTransform));
+        return t;
+    }
+};
+
+VERTEX_FORMAT(InstanceTransform,
+    VERTEX_ELEMENT(InstanceTransform, row0, "WORLD", 0),
+    VERTEX_ELEMENT(InstanceTransform, row1, "WORLD", 1),
+    VERTEX_ELEMENT(InstanceTransform, row2, "WORLD", 2));
+
 
 class Triangle {
 public:
     ID3D11Buffer* vertexBuffer = nullptr;
+    // 状态对象由 core->states 共享和持有，不需要释放
     ID3D11RasterizerState* rasterizerState = nullptr;
     ID3D11BlendState* blendState = nullptr;
 
@@ -49,10 +123,7 @@ public:
         rsdesc.FillMode = D3D11_FILL_SOLID;
         rsdesc.CullMode = D3D11_CULL_NONE;
 
-        hr = core->device->CreateRasterizerState(&rsdesc, &rasterizerState);
-        if (FAILED(hr)) {
-            throw std::runtime_error("Failed to create rasterizer state.");
-        }
+        rasterizerState = core->states.getRasterizerState(core->device, rsdesc);
 
         // 配置混合状态
         D3D11_BLEND_DESC blendDesc = {};
@@ -60,10 +131,7 @@ public:
         blendDesc.RenderTarget[0].BlendEnable = FALSE;
         blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
-        hr = core->device->CreateBlendState(&blendDesc, &blendState);
-        if (FAILED(hr)) {
-            throw std::runtime_error("Failed to create blend state.");
-        }
+        blendState = core->states.getBlendState(core->device, blendDesc);
     }
 
     // 渲染三角形
@@ -83,4 +151,331 @@ public:
         // 绘制三角形
         devicecontext->Draw(3, 0);
     }
+};
+
+// 子网格：索引缓冲区中的一段，索引相对于 baseVertex
+struct SubMesh {
+    unsigned int indexStart = 0;
+    unsigned int indexCount = 0;
+    int baseVertex = 0;
+    MeshBounds bounds; // 模型空间包围盒和包围球，从 GEM 模型创建时计算
+};
+
+// 带索引的网格：顶点和索引各上传一次，按子网格范围 DrawIndexed。
+// 每个子网格的顶点数不超过 65536 时使用 16 位索引。
+class Mesh {
+public:
+    ID3D11Buffer* vertexBuffer = nullptr;
+    ID3D11Buffer* indexBuffer = nullptr;
+    DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT;
+    unsigned int vertexStride = 0;
+    unsigned int vertexCount = 0;
+    unsigned int indexCount = 0;
+    std::vector<SubMesh> subMeshes;
+    MeshBounds bounds; // 所有子网格的包围体
+
+    // indices 为每个子网格内的局部索引，按 subMeshes 的顺序排列。
+    // vertices 和 indices 可以直接指向映射的文件，不要求对齐
+    void init(Core* core, const void* vertices, unsigned int stride, unsigned int numVertices, const void* indices, unsigned int numIndices, const std::vector<SubMesh>& ranges) {
+        vertexStride = stride;
+        vertexCount = numVertices;
+        indexCount = numIndices;
+        subMeshes = ranges;
+
+        // 创建顶点缓冲区
+        D3D11_BUFFER_DESC bd = {};
+        bd.Usage = D3D11_USAGE_IMMUTABLE;
+        bd.ByteWidth = stride * numVertices;
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+        D3D11_SUBRESOURCE_DATA uploadData = {};
+        uploadData.pSysMem = vertices;
+
+        HRESULT hr = core->device->CreateBuffer(&bd, &uploadData, &vertexBuffer);
+        if (FAILED(hr)) {
+            throw std::runtime_error("Failed to create vertex buffer.");
+        }
+
+        // 所有索引都能用 16 位表示时，索引内存减半
+        const unsigned char* indexBytes = static_cast<const unsigned char*>(indices);
+        auto indexAt = [indexBytes](unsigned int i) {
+            unsigned int index;
+            memcpy(&index, indexBytes + i * sizeof(unsigned int), sizeof(unsigned int));
+            return index;
+        };
+        unsigned int maxIndex = 0;
+        for (unsigned int i = 0; i < numIndices; i++) {
+            maxIndex = (std::max)(maxIndex, indexAt(i));
+        }
+        std::vector<unsigned short> indices16;
+        if (maxIndex <= 0xFFFF) {
+            indexFormat = DXGI_FORMAT_R16_UINT;
+            indices16.resize(numIndices);
+            for (unsigned int i = 0; i < numIndices; i++) {
+                indices16[i] = static_cast<unsigned short>(indexAt(i));
+            }
+            bd.ByteWidth = sizeof(unsigned short) * numIndices;
+            uploadData.pSysMem = indices16.data();
+        }
+        else {
+            indexFormat = DXGI_FORMAT_R32_UINT;
+            bd.ByteWidth = sizeof(unsigned int) * numIndices;
+            uploadData.pSysMem = indices;
+        }
+
+        // 创建索引缓冲区
+        bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+        hr = core->device->CreateBuffer(&bd, &uploadData, &indexBuffer);
+        if (FAILED(hr)) {
+            throw std::runtime_error("Failed to create index buffer.");
+        }
+    }
+
+    template<typename T>
+    void init(Core* core, const std::vector<T>& vertices, const std::vector<unsigned int>& indices) {
+        SubMesh whole;
+        whole.indexCount = static_cast<unsigned int>(indices.size());
+        init(core, vertices.data(), sizeof(T), static_cast<unsigned int>(vertices.size()), indices.data(), whole.indexCount, { whole });
+    }
+
+    // 从 GEM 模型创建，每个 GEMMesh 成为一个子网格，共用一个顶点缓冲区和一个索引缓冲区
+    void init(Core* core, const std::vector<GEMLoader::GEMMesh>& meshes) {
+        bool animated = !meshes.empty() && !meshes[0].verticesAnimated.empty();
+        std::vector<GEMLoader::GEMStaticVertex> staticVertices;
+        std::vector<GEMLoader::GEMAnimatedVertex> animatedVertices;
+        std::vector<unsigned int> indices;
+        std::vector<SubMesh> ranges;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const GEMLoader::GEMMesh& mesh = meshes[i];
+            if (mesh.verticesAnimated.empty() == animated) {
+                throw std::runtime_error("Cannot mix static and animated GEM meshes in one Mesh.");
+            }
+            SubMesh range;
+            range.indexStart = static_cast<unsigned int>(indices.size());
+            range.indexCount = static_cast<unsigned int>(mesh.indices.size());
+            range.baseVertex = static_cast<int>(animated ? animatedVertices.size() : staticVertices.size());
+            range.bounds = MeshBounds::fromGEMMesh(mesh);
+            ranges.push_back(range);
+
+            staticVertices.insert(staticVertices.end(), mesh.verticesStatic.begin(), mesh.verticesStatic.end());
+            animatedVertices.insert(animatedVertices.end(), mesh.verticesAnimated.begin(), mesh.verticesAnimated.end());
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        }
+        if (animated) {
+            init(core, animatedVertices.data(), sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(animatedVertices.size()), indices.data(), static_cast<unsigned int>(indices.size()), ranges);
+        }
+        else {
+            init(core, staticVertices.data(), sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(staticVertices.size()), indices.data(), static_cast<unsigned int>(indices.size()), ranges);
+        }
+        for (size_t i = 0; i < subMeshes.size(); i++) {
+            if (i == 0) bounds = subMeshes[i].bounds;
+            else bounds.merge(subMeshes[i].bounds);
+        }
+    }
+
+    void init(Core* core, const GEMLoader::GEMMesh& mesh) {
+        init(core, std::vector<GEMLoader::GEMMesh>{ mesh });
+    }
+
+    // 直接从映射的文件内存上传（bytes 指向映射本身，不用对齐副本），不经过中间的 std::vector 拷贝
+    void init(Core* core, const GEMLoader::GEMMeshView& mesh) {
+        SubMesh whole;
+        whole.indexCount = static_cast<unsigned int>(mesh.indices.size());
+        if (mesh.isAnimated()) {
+            whole.bounds = MeshBounds::fromPositions(mesh.verticesAnimated.data, sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()));
+            init(core, mesh.verticesAnimated.bytes, sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()), mesh.indices.bytes, whole.indexCount, { whole });
+        }
+        else {
+            whole.bounds = MeshBounds::fromPositions(mesh.verticesStatic.data, sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()));
+            init(core, mesh.verticesStatic.bytes, sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()), mesh.indices.bytes, whole.indexCount, { whole });
+        }
+        bounds = whole.bounds;
+    }
+
+    // 上传 LOD 链：所有级别共用顶点缓冲区，每个级别是一个子网格，用 renderSubMesh(level) 绘制
+    void initLODs(Core* core, const GEMLoader::GEMMesh& mesh, const LODChain& chain) {
+        std::vector<SubMesh> ranges;
+        for (size_t i = 0; i < chain.levels.size(); i++) {
+            SubMesh range;
+            range.indexStart = chain.levels[i].firstIndex;
+            range.indexCount = chain.levels[i].indexCount;
+            ranges.push_back(range);
+        }
+        if (!mesh.verticesAnimated.empty()) {
+            init(core, mesh.verticesAnimated.data(), sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()), chain.indices.data(), static_cast<unsigned int>(chain.indices.size()), ranges);
+        }
+        else {
+            init(core, mesh.verticesStatic.data(), sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()), chain.indices.data(), static_cast<unsigned int>(chain.indices.size()), ranges);
+        }
+    }
+
+    // 以压缩顶点上传，顶点内存约为原来的一半或更少。bounds 需要传给顶点着色器用于解码位置。
+    VertexCompressionError initCompressed(Core* core, const GEMLoader::GEMMesh& mesh, CompressedMeshBounds& bounds) {
+        VertexCompressor compressor;
+        VertexCompressionError error;
+        if (!mesh.verticesAnimated.empty()) {
+            std::vector<CompressedAnimatedVertex> vertices;
+            error = compressor.compress(mesh.verticesAnimated, vertices, bounds);
+            init(core, vertices, mesh.indices);
+        }
+        else {
+            std::vector<CompressedStaticVertex> vertices;
+            error = compressor.compress(mesh.verticesStatic, vertices, bounds);
+            init(core, vertices, mesh.indices);
+        }
+        return error;
+    }
+
+    // 绑定顶点和索引缓冲区，之后可以多次调用 renderSubMesh
+    void bind(ID3D11DeviceContext* devicecontext) {
+        UINT offsets = 0;
+        UINT strides = vertexStride;
+        devicecontext->IASetVertexBuffers(0, 1, &vertexBuffer, &strides, &offsets);
+        devicecontext->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+        devicecontext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    }
+
+    void renderSubMesh(ID3D11DeviceContext* devicecontext, size_t i) {
+        devicecontext->DrawIndexed(subMeshes[i].indexCount, subMeshes[i].indexStart, subMeshes[i].baseVertex);
+    }
+
+    // 只绘制子网格中的部分索引范围，例如剔除后可见的 meshlet。范围相对于子网格的起始索引。
+    void renderRanges(ID3D11DeviceContext* devicecontext, size_t i, const std::vector<IndexRange>& ranges) {
+        for (size_t r = 0; r < ranges.size(); r++) {
+            devicecontext->DrawIndexed(ranges[r].indexCount, subMeshes[i].indexStart + ranges[r].firstIndex, subMeshes[i].baseVertex);
+        }
+    }
+
+    // 渲染全部子网格
+    void render(ID3D11DeviceContext* devicecontext) {
+        bind(devicecontext);
+        for (size_t i = 0; i < subMeshes.size(); i++) {
+            renderSubMesh(devicecontext, i);
+        }
+    }
+
+    // 实例化渲染：每实例数据绑定到槽位 1，每个子网格一次 DrawIndexedInstanced
+    void renderInstanced(ID3D11DeviceContext* devicecontext, ID3D11Buffer* instanceBuffer, UINT instanceStride, UINT instanceCount) {
+        if (instanceCount == 0) return;
+        bind(devicecontext);
+        UINT offsets = 0;
+        devicecontext->IASetVertexBuffers(1, 1, &instanceBuffer, &instanceStride, &offsets);
+        for (size_t i = 0; i < subMeshes.size(); i++) {
+            devicecontext->DrawIndexedInstanced(subMeshes[i].indexCount, instanceCount, subMeshes[i].indexStart, subMeshes[i].baseVertex, 0);
+        }
+    }
+
+    void release() {
+        if (vertexBuffer) vertexBuffer->Release();
+        if (indexBuffer) indexBuffer->Release();
+        vertexBuffer = nullptr;
+        indexBuffer = nullptr;
+    }
+};
+
+// 每实例数据缓冲区（动态，容量不足时自动扩大）。pack 映射缓冲区后由 fn(i, data) 填写第 i 个实例，
+// 传入线程池时分块并行填写；写入的是映射内存，不经过额外的 CPU 副本。
+template<typename T>
+class InstanceBuffer {
+public:
+    ID3D11Buffer* buffer = nullptr;
+    unsigned int capacity = 0;
+    unsigned int count = 0;
+
+    void init(Core* core, unsigned int initialCapacity) {
+        grow(core, initialCapacity);
+    }
+
+    template<typename F>
+    void pack(Core* core, unsigned int instanceCount, F fn, ThreadPool* pool = nullptr) {
+        if (instanceCount > capacity) {
+            // 按 1.5 倍扩大，避免数量缓慢增长时每帧重建缓冲区
+            grow(core, (std::max)(instanceCount, capacity + capacity / 2));
+        }
+        count = instanceCount;
+        if (instanceCount == 0) return;
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (FAILED(core->deviceContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+            throw std::runtime_error("Failed to map instance buffer.");
+        }
+        T* data = static_cast<T*>(mapped.pData);
+        auto fill = [&fn, data](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                fn(i, data[i]);
+            }
+        };
+        if (pool) {
+            pool->parallelFor(instanceCount, 4096, fill);
+        }
+        else {
+            fill(0, instanceCount);
+        }
+        core->deviceContext->Unmap(buffer, 0);
+    }
+
+    // 从世界矩阵数组打包（T 为 InstanceTransform 时）
+    void pack(Core* core, const std::vector<Matrix>& worlds, ThreadPool* pool = nullptr) {
+        const Matrix* source = worlds.data();
+        pack(core, static_cast<unsigned int>(worlds.size()), [source](size_t i, T& instance) {
+            instance = T::fromMatrix(source[i]);
+        }, pool);
+    }
+
+    void render(ID3D11DeviceContext* devicecontext, Mesh& mesh) {
+        mesh.renderInstanced(devicecontext, buffer, sizeof(T), count);
+    }
+
+    void release() {
+        if (buffer) buffer->Release();
+        buffer = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+
+private:
+    void grow(Core* core, unsigned int newCapacity) {
+        if (buffer) buffer->Release();
+        buffer = nullptr;
+        capacity = (std::max)(newCapacity, 1u);
+
+        D3D11_BUFFER_DESC bd = {};
+        bd.Usage = D3D11_USAGE_DYNAMIC;
+        bd.ByteWidth = sizeof(T) * capacity;
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+        HRESULT hr = core->device->CreateBuffer(&bd, NULL, &buffer);
+        if (FAILED(hr)) {
+            throw std::runtime_error("Failed to create instance buffer.");
+        }
+    }
+};
+
+// RenderQueue 的 D3D11 后端：DrawPacket 中的 shader、mesh 是下面数组的下标，
+// 材质没有固定的表示方式，由 bindMaterialFunc 负责绑定（例如纹理和材质常量缓冲区）
+class MeshRenderBackend {
+public:
+    Core* core = nullptr;
+    std::vector<Shader*> shaders;
+    std::vector<Mesh*> meshes;
+    std::function<void(Core*, unsigned int)> bindMaterialFunc;
+    ConstantBufferRing* ring = nullptr;
+
+    void bindShader(unsigned int shader) {
+        shaders[shader]->bind(core, ring);
+    }
+
+    void bindMaterial(unsigned int material) {
+        if (bindMaterialFunc) bindMaterialFunc(core, material);
+    }
+
+    void bindMesh(unsigned int mesh) {
+        meshes[mesh]->bind(core->deviceContext);
+    }
+
+    void draw(const DrawPacket& packet) {
+        Mesh* mesh = meshes[packet.mesh];
+        mesh->renderSubMesh(core->deviceContext, packet.subMesh);
+    }
 };
\ No newline at end of file
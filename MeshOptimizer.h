@@ -0,0 +1,347 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "GEMLoader.h"
+
+// Vertex cache efficiency of an index buffer, measured with a FIFO cache simulation.
+// ACMR is transformed vertices per triangle (0.5 is the ideal for large regular meshes, 3 the
+// worst case), ATVR is transformed vertices per unique vertex (1 is ideal).
+struct VertexCacheStats
+{
+	float acmr = 0.0f;
+	float atvr = 0.0f;
+};
+
+struct MeshOptimizationReport
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+	unsigned int triangles = 0;
+	unsigned int vertices = 0;
+};
+
+// Load-time reordering of indexed triangle lists, no re-export needed:
+//   optimizeVertexCache - Tipsify (Sander, Nehab and Barczak 2007), linear time
+//   optimizeOverdraw    - sorts Tipsify's clusters so outward-facing ones draw first
+//   optimizeVertexFetch - renumbers vertices in first-use order so fetches are sequential
+class MeshOptimizer
+{
+public:
+	// Post-transform cache size to optimise for; 16 to 32 matches most GPUs
+	unsigned int cacheSize = 16;
+	bool overdraw = true;
+
+	static VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, unsigned int vertexCount, unsigned int cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		if (indices.empty())
+		{
+			return stats;
+		}
+		// A vertex is in the FIFO if it was pushed fewer than cacheSize misses ago
+		std::vector<unsigned int> pushedAt(vertexCount, 0);
+		std::vector<unsigned char> used(vertexCount, 0);
+		unsigned int misses = 0;
+		unsigned int unique = 0;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int v = indices[i];
+			if (!used[v])
+			{
+				used[v] = 1;
+				unique++;
+			}
+			if (pushedAt[v] == 0 || misses - pushedAt[v] >= cacheSize)
+			{
+				misses++;
+				pushedAt[v] = misses;
+			}
+		}
+		stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+		stats.atvr = static_cast<float>(misses) / static_cast<float>(unique);
+		return stats;
+	}
+
+	// Reorders triangles for the post-transform cache. clusters receives the index offset at
+	// which each cluster starts, the points where Tipsify had to jump and the cache is cold.
+	static void optimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount, unsigned int cacheSize, std::vector<unsigned int>* clusters = nullptr)
+	{
+		unsigned int triangleCount = static_cast<unsigned int>(indices.size() / 3);
+		if (triangleCount == 0)
+		{
+			return;
+		}
+		// Vertex to triangle adjacency in one flat array
+		std::vector<unsigned int> live(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			live[indices[i]]++;
+		}
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] = offsets[v] + live[v];
+		}
+		std::vector<unsigned int> adjacency(offsets[vertexCount]);
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (unsigned int t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				adjacency[fill[indices[t * 3 + k]]++] = t;
+			}
+		}
+
+		std::vector<unsigned int> cacheTime(vertexCount, 0);
+		std::vector<unsigned char> emitted(triangleCount, 0);
+		std::vector<unsigned int> deadEnd;
+		std::vector<unsigned int> candidates;
+		std::vector<unsigned int> output;
+		output.reserve(triangleCount * 3);
+		if (clusters)
+		{
+			clusters->clear();
+			clusters->push_back(0);
+		}
+		unsigned int time = cacheSize + 1;
+		unsigned int cursor = 0;
+		int fanning = 0;
+		while (fanning >= 0)
+		{
+			candidates.clear();
+			unsigned int f = static_cast<unsigned int>(fanning);
+			for (unsigned int a = offsets[f]; a < offsets[f + 1]; a++)
+			{
+				unsigned int t = adjacency[a];
+				if (emitted[t])
+				{
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int v = indices[t * 3 + k];
+					output.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (time - cacheTime[v] > cacheSize)
+					{
+						cacheTime[v] = time;
+						time++;
+					}
+				}
+				emitted[t] = 1;
+			}
+			// Prefer the candidate that stays in the cache longest while it is still needed
+			int next = -1;
+			int bestPriority = -1;
+			for (size_t c = 0; c < candidates.size(); c++)
+			{
+				unsigned int v = candidates[c];
+				if (live[v] == 0)
+				{
+					continue;
+				}
+				int priority = 0;
+				if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+				{
+					priority = static_cast<int>(time - cacheTime[v]);
+				}
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = static_cast<int>(v);
+				}
+			}
+			if (next == -1)
+			{
+				next = skipDeadEnd(deadEnd, live, cursor, vertexCount);
+				if (next >= 0 && clusters && clusters->back() != output.size())
+				{
+					clusters->push_back(static_cast<unsigned int>(output.size()));
+				}
+			}
+			fanning = next;
+		}
+		indices.swap(output);
+	}
+
+	// Sorts clusters by how far they face away from the mesh centre, so triangles likely to
+	// occlude others are drawn first. positions points at the first vertex's x, y, z floats.
+	static void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<unsigned int>& clusters, const void* positions, size_t stride, unsigned int vertexCount)
+	{
+		if (clusters.size() < 2)
+		{
+			return;
+		}
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+		float centre[3] = { 0, 0, 0 };
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				centre[k] += position(v)[k] / vertexCount;
+			}
+		}
+		struct Cluster
+		{
+			unsigned int start;
+			unsigned int end;
+			float sortKey;
+		};
+		std::vector<Cluster> sorted(clusters.size());
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			Cluster& cluster = sorted[c];
+			cluster.start = clusters[c];
+			cluster.end = (c + 1 < clusters.size()) ? clusters[c + 1] : static_cast<unsigned int>(indices.size());
+			// Area weighted centroid and normal of the cluster
+			float centroid[3] = { 0, 0, 0 };
+			float normal[3] = { 0, 0, 0 };
+			float area = 0;
+			for (unsigned int i = cluster.start; i < cluster.end; i += 3)
+			{
+				const float* p0 = position(indices[i]);
+				const float* p1 = position(indices[i + 1]);
+				const float* p2 = position(indices[i + 2]);
+				float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+				float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int k = 0; k < 3; k++)
+				{
+					centroid[k] += (p0[k] + p1[k] + p2[k]) * a / 3.0f;
+					normal[k] += n[k];
+				}
+				area += a;
+			}
+			cluster.sortKey = 0;
+			if (area > 0)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					cluster.sortKey += (centroid[k] / area - centre[k]) * normal[k];
+				}
+				cluster.sortKey /= area;
+			}
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+		std::vector<unsigned int> output;
+		output.reserve(indices.size());
+		for (size_t c = 0; c < sorted.size(); c++)
+		{
+			output.insert(output.end(), indices.begin() + sorted[c].start, indices.begin() + sorted[c].end);
+		}
+		indices.swap(output);
+	}
+
+	// Renumbers vertices in the order the index buffer first uses them and drops unused ones
+	template<typename Vertex>
+	static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		const unsigned int unassigned = 0xFFFFFFFF;
+		std::vector<unsigned int> remap(vertices.size(), unassigned);
+		std::vector<Vertex> output;
+		output.reserve(vertices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int& r = remap[indices[i]];
+			if (r == unassigned)
+			{
+				r = static_cast<unsigned int>(output.size());
+				output.push_back(vertices[indices[i]]);
+			}
+			indices[i] = r;
+		}
+		vertices.swap(output);
+	}
+
+	template<typename Vertex>
+	MeshOptimizationReport optimize(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		MeshOptimizationReport report;
+		if (indices.empty())
+		{
+			return report;
+		}
+		unsigned int vertexCount = static_cast<unsigned int>(vertices.size());
+		report.triangles = static_cast<unsigned int>(indices.size() / 3);
+		report.vertices = vertexCount;
+		report.before = analyzeVertexCache(indices, vertexCount, cacheSize);
+		std::vector<unsigned int> clusters;
+		optimizeVertexCache(indices, vertexCount, cacheSize, &clusters);
+		if (overdraw)
+		{
+			optimizeOverdraw(indices, clusters, &vertices[0].position, sizeof(Vertex), vertexCount);
+		}
+		optimizeVertexFetch(vertices, indices);
+		report.after = analyzeVertexCache(indices, static_cast<unsigned int>(vertices.size()), cacheSize);
+		return report;
+	}
+
+	MeshOptimizationReport optimize(GEMLoader::GEMMesh& mesh)
+	{
+		if (!mesh.verticesAnimated.empty())
+		{
+			return optimize(mesh.verticesAnimated, mesh.indices);
+		}
+		return optimize(mesh.verticesStatic, mesh.indices);
+	}
+
+	// Optimises every mesh of a model, the report is weighted by triangle count
+	MeshOptimizationReport optimize(std::vector<GEMLoader::GEMMesh>& meshes)
+	{
+		MeshOptimizationReport total;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			MeshOptimizationReport report = optimize(meshes[i]);
+			float w = static_cast<float>(report.triangles);
+			total.before.acmr += report.before.acmr * w;
+			total.after.acmr += report.after.acmr * w;
+			total.before.atvr += report.before.atvr * report.vertices;
+			total.after.atvr += report.after.atvr * report.vertices;
+			total.triangles += report.triangles;
+			total.vertices += report.vertices;
+		}
+		if (total.triangles > 0)
+		{
+			total.before.acmr /= total.triangles;
+			total.after.acmr /= total.triangles;
+		}
+		if (total.vertices > 0)
+		{
+			total.before.atvr /= total.vertices;
+			total.after.atvr /= total.vertices;
+		}
+		return total;
+	}
+
+private:
+	static int skipDeadEnd(std::vector<unsigned int>& deadEnd, const std::vector<unsigned int>& live, unsigned int& cursor, unsigned int vertexCount)
+	{
+		while (!deadEnd.empty())
+		{
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0)
+			{
+				return static_cast<int>(v);
+			}
+		}
+		while (cursor < vertexCount)
+		{
+			if (live[cursor] > 0)
+			{
+				return static_cast<int>(cursor);
+			}
+			cursor++;
+		}
+		return -1;
+	}
+};
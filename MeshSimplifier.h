@@ -0,0 +1,535 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "GEMLoader.h"
+#include "ThreadPool.h"
+
+// One level of detail: a range of LODChain::indices drawn with the original vertex buffer
+struct MeshLOD
+{
+	unsigned int firstIndex = 0;
+	unsigned int indexCount = 0;
+	// Largest geometric deviation from the full mesh, relative to the mesh radius
+	float error = 0.0f;
+};
+
+// Every level's indices back to back, level 0 is the full mesh. Upload chain.indices once and
+// draw a level as a sub range, see Mesh::initLODs.
+struct LODChain
+{
+	std::vector<unsigned int> indices;
+	std::vector<MeshLOD> levels;
+	float radius = 0.0f;
+};
+
+// Quadric error metric simplification (Garland and Heckbert 1997) by collapsing vertices onto
+// their neighbours. No vertices are created, so every level indexes the original vertex buffer.
+// Vertices on a UV or normal seam (same position, different attributes) and on open borders
+// never move, so seams stay closed and texture coordinates stay valid.
+class MeshSimplifier
+{
+public:
+	// Returns indices with at most targetIndexCount indices, or fewer collapses if the error
+	// would pass maxError (relative to the mesh radius). error receives the error reached.
+	static std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices, const void* positions, size_t stride, unsigned int vertexCount, unsigned int targetIndexCount, float maxError, float* error = nullptr)
+	{
+		std::vector<unsigned int> result = indices;
+		if (error)
+		{
+			*error = 0.0f;
+		}
+		if (result.size() <= targetIndexCount || vertexCount == 0)
+		{
+			return result;
+		}
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+
+		// Vertices that share a position are one point for quadrics and seam detection
+		std::vector<unsigned int> canonical(vertexCount);
+		std::vector<unsigned char> seam(vertexCount, 0);
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash> unique;
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			PositionKey key;
+			memcpy(key.p, position(v), sizeof(key.p));
+			auto it = unique.find(key);
+			if (it == unique.end())
+			{
+				unique[key] = v;
+				canonical[v] = v;
+			}
+			else
+			{
+				canonical[v] = it->second;
+				seam[v] = 1;
+				seam[it->second] = 1;
+			}
+		}
+		float radius = meshRadius(indices, positions, stride);
+		if (radius == 0.0f)
+		{
+			return result;
+		}
+
+		// Open border edges are used by only one triangle
+		std::unordered_map<unsigned long long, unsigned int> edgeUse;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				edgeUse[edgeKey(canonical[result[i + k]], canonical[result[i + (k + 1) % 3]])]++;
+			}
+		}
+		std::vector<unsigned char> locked(seam);
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = result[i + k];
+				unsigned int b = result[i + (k + 1) % 3];
+				if (edgeUse[edgeKey(canonical[a], canonical[b])] == 1)
+				{
+					locked[a] = 1;
+					locked[b] = 1;
+				}
+			}
+		}
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			if (locked[canonical[v]])
+			{
+				locked[v] = 1;
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			Quadric q = Quadric::fromTriangle(position(result[i]), position(result[i + 1]), position(result[i + 2]));
+			for (int k = 0; k < 3; k++)
+			{
+				quadrics[canonical[result[i + k]]].add(q);
+			}
+		}
+
+		double maxCost = static_cast<double>(maxError) * maxError * radius * radius;
+		double reached = 0.0;
+		std::vector<unsigned int> remap(vertexCount);
+		std::vector<unsigned char> touched(vertexCount);
+		std::vector<Collapse> collapses;
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> adjacency;
+		while (result.size() > targetIndexCount)
+		{
+			buildAdjacency(result, vertexCount, offsets, adjacency);
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int from = result[i + k];
+					unsigned int to = result[i + (k + 1) % 3];
+					if (!locked[from] && from != to)
+					{
+						Collapse c;
+						c.from = from;
+						c.to = to;
+						Quadric q = quadrics[canonical[from]];
+						q.add(quadrics[canonical[to]]);
+						c.cost = (std::max)(0.0, q.evaluate(position(to)));
+						collapses.push_back(c);
+					}
+				}
+			}
+			if (collapses.empty())
+			{
+				break;
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			// Each collapse removes about two triangles; do a batch per pass, never touching
+			// the neighbourhood of a vertex that already moved in this pass
+			size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+			size_t removed = 0;
+			for (unsigned int v = 0; v < vertexCount; v++)
+			{
+				remap[v] = v;
+			}
+			std::fill(touched.begin(), touched.end(), 0);
+			for (size_t c = 0; c < collapses.size() && removed < trianglesToRemove; c++)
+			{
+				const Collapse& collapse = collapses[c];
+				if (collapse.cost > maxCost)
+				{
+					break;
+				}
+				if (touched[collapse.from] || touched[collapse.to])
+				{
+					continue;
+				}
+				if (flips(result, offsets, adjacency, collapse.from, collapse.to, positions, stride))
+				{
+					continue;
+				}
+				remap[collapse.from] = collapse.to;
+				quadrics[canonical[collapse.to]].add(quadrics[canonical[collapse.from]]);
+				reached = (std::max)(reached, collapse.cost);
+				for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++)
+				{
+					unsigned int t = adjacency[a];
+					bool shared = false;
+					for (int k = 0; k < 3; k++)
+					{
+						touched[result[t * 3 + k]] = 1;
+						shared = shared || result[t * 3 + k] == collapse.to;
+					}
+					removed += shared ? 1 : 0;
+				}
+			}
+			if (removed == 0)
+			{
+				break;
+			}
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				unsigned int a = remap[result[i]];
+				unsigned int b = remap[result[i + 1]];
+				unsigned int c = remap[result[i + 2]];
+				if (a != b && b != c && a != c)
+				{
+					result[write++] = a;
+					result[write++] = b;
+					result[write++] = c;
+				}
+			}
+			result.resize(write);
+		}
+		if (error)
+		{
+			*error = static_cast<float>(sqrt(reached)) / radius;
+		}
+		return result;
+	}
+
+	// Distance from the centre of the bounding box to its furthest vertex
+	static float meshRadius(const std::vector<unsigned int>& indices, const void* positions, size_t stride)
+	{
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+		if (indices.empty())
+		{
+			return 0.0f;
+		}
+		float lo[3] = { position(indices[0])[0], position(indices[0])[1], position(indices[0])[2] };
+		float hi[3] = { lo[0], lo[1], lo[2] };
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			const float* p = position(indices[i]);
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = (std::min)(lo[k], p[k]);
+				hi[k] = (std::max)(hi[k], p[k]);
+			}
+		}
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			const float* p = position(indices[i]);
+			float d = 0.0f;
+			for (int k = 0; k < 3; k++)
+			{
+				float e = p[k] - (lo[k] + hi[k]) * 0.5f;
+				d += e * e;
+			}
+			radiusSquared = (std::max)(radiusSquared, d);
+		}
+		return sqrtf(radiusSquared);
+	}
+
+private:
+	struct PositionKey
+	{
+		float p[3];
+
+		bool operator==(const PositionKey& other) const
+		{
+			return memcmp(p, other.p, sizeof(p)) == 0;
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey& key) const
+		{
+			unsigned int bits[3];
+			memcpy(bits, key.p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+
+	// Symmetric 4x4 matrix of squared distances to a set of planes, upper triangle only
+	struct Quadric
+	{
+		double a[10] = {};
+
+		static Quadric fromTriangle(const float* p0, const float* p1, const float* p2)
+		{
+			Quadric q;
+			double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length == 0.0)
+			{
+				return q;
+			}
+			// Weighted by area so large faces hold their shape
+			double weight = length * 0.5;
+			double x = n[0] / length;
+			double y = n[1] / length;
+			double z = n[2] / length;
+			double d = -(x * p0[0] + y * p0[1] + z * p0[2]);
+			q.a[0] = x * x * weight;
+			q.a[1] = x * y * weight;
+			q.a[2] = x * z * weight;
+			q.a[3] = x * d * weight;
+			q.a[4] = y * y * weight;
+			q.a[5] = y * z * weight;
+			q.a[6] = y * d * weight;
+			q.a[7] = z * z * weight;
+			q.a[8] = z * d * weight;
+			q.a[9] = d * d * weight;
+			return q;
+		}
+
+		void add(const Quadric& other)
+		{
+			for (int i = 0; i < 10; i++)
+			{
+				a[i] += other.a[i];
+			}
+		}
+
+		// Area-weighted sum of squared distances, divided by the total area
+		double evaluate(const float* p) const
+		{
+			double x = p[0];
+			double y = p[1];
+			double z = p[2];
+			double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				+ a[7] * z * z + 2 * a[8] * z
+				+ a[9];
+			double area = a[0] + a[4] + a[7];
+			return area > 0.0 ? e / area : 0.0;
+		}
+	};
+
+	static unsigned long long edgeKey(unsigned int a, unsigned int b)
+	{
+		if (a > b)
+		{
+			std::swap(a, b);
+		}
+		return (static_cast<unsigned long long>(a) << 32) | b;
+	}
+
+	static void buildAdjacency(const std::vector<unsigned int>& indices, unsigned int vertexCount, std::vector<unsigned int>& offsets, std::vector<unsigned int>& adjacency)
+	{
+		offsets.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			offsets[indices[i] + 1]++;
+		}
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		adjacency.resize(indices.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+	}
+
+	// True if moving from onto to would turn any surviving triangle around from over
+	static bool flips(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& adjacency, unsigned int from, unsigned int to, const void* positions, size_t stride)
+	{
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+		for (unsigned int a = offsets[from]; a < offsets[from + 1]; a++)
+		{
+			const unsigned int* t = &indices[adjacency[a] * 3];
+			if (t[0] == to || t[1] == to || t[2] == to)
+			{
+				continue;
+			}
+			float before[3];
+			float after[3];
+			normal(position(t[0]), position(t[1]), position(t[2]), before);
+			normal(position(t[0] == from ? to : t[0]), position(t[1] == from ? to : t[1]), position(t[2] == from ? to : t[2]), after);
+			float lengthBefore = sqrtf(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+			float lengthAfter = sqrtf(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+			// Also reject collapses that leave a sliver with almost no area
+			if (lengthAfter <= lengthBefore * 1e-4f)
+			{
+				return true;
+			}
+			float cosine = (before[0] * after[0] + before[1] * after[1] + before[2] * after[2]) / (lengthBefore * lengthAfter);
+			if (cosine < 0.25f)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void normal(const float* p0, const float* p1, const float* p2, float* n)
+	{
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+};
+
+// Builds a LOD chain per mesh, each level aiming for reduction times the previous level's
+// triangles. Levels stop early once the error limit is reached.
+class LODGenerator
+{
+public:
+	unsigned int maxLevels = 5;
+	float reduction = 0.5f;
+	float maxError = 0.05f;
+	// Levels that removed less than this fraction of triangles are dropped
+	float minReduction = 0.1f;
+
+	LODChain generate(const std::vector<unsigned int>& indices, const void* positions, size_t stride, unsigned int vertexCount) const
+	{
+		LODChain chain;
+		chain.radius = MeshSimplifier::meshRadius(indices, positions, stride);
+		chain.indices = indices;
+		MeshLOD full;
+		full.indexCount = static_cast<unsigned int>(indices.size());
+		chain.levels.push_back(full);
+		std::vector<unsigned int> previous = indices;
+		for (unsigned int level = 1; level < maxLevels; level++)
+		{
+			unsigned int target = static_cast<unsigned int>(previous.size() / 3 * reduction) * 3;
+			float error = 0.0f;
+			std::vector<unsigned int> simplified = MeshSimplifier::simplify(previous, positions, stride, vertexCount, target, maxError, &error);
+			if (simplified.empty() || simplified.size() > previous.size() * (1.0f - minReduction))
+			{
+				break;
+			}
+			MeshLOD lod;
+			lod.firstIndex = static_cast<unsigned int>(chain.indices.size());
+			lod.indexCount = static_cast<unsigned int>(simplified.size());
+			// Each level starts from the previous one, so errors only grow
+			lod.error = (std::max)(error, chain.levels.back().error);
+			chain.indices.insert(chain.indices.end(), simplified.begin(), simplified.end());
+			chain.levels.push_back(lod);
+			previous.swap(simplified);
+		}
+		return chain;
+	}
+
+	LODChain generate(const GEMLoader::GEMMesh& mesh) const
+	{
+		if (!mesh.verticesAnimated.empty())
+		{
+			return generate(mesh.indices, &mesh.verticesAnimated[0].position, sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()));
+		}
+		if (mesh.verticesStatic.empty())
+		{
+			return LODChain();
+		}
+		return generate(mesh.indices, &mesh.verticesStatic[0].position, sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()));
+	}
+
+	// One mesh per task; without a pool the meshes are processed on the calling thread
+	std::vector<LODChain> generate(const std::vector<GEMLoader::GEMMesh>& meshes, ThreadPool* pool = nullptr) const
+	{
+		std::vector<LODChain> chains(meshes.size());
+		auto work = [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				chains[i] = generate(meshes[i]);
+			}
+		};
+		if (pool)
+		{
+			pool->parallelFor(meshes.size(), 1, work);
+		}
+		else
+		{
+			work(0, meshes.size());
+		}
+		return chains;
+	}
+};
+
+// Picks the coarsest level whose error covers no more than maxPixelError pixels on screen
+class LODSelector
+{
+public:
+	// Pixels per world unit at distance 1: viewport height / (2 tan(fovY / 2))
+	float pixelsPerUnit = 1.0f;
+	float maxPixelError = 1.0f;
+
+	static LODSelector fromPerspective(float fovY, float viewportHeight, float maxPixelError = 1.0f)
+	{
+		LODSelector selector;
+		selector.pixelsPerUnit = viewportHeight / (2.0f * tanf(fovY * 0.5f));
+		selector.maxPixelError = maxPixelError;
+		return selector;
+	}
+
+	// projection from Matrix::Perspective, whose m[5] is 1 / tan(fovY / 2)
+	static LODSelector fromProjection(const float* projection, float viewportHeight, float maxPixelError = 1.0f)
+	{
+		LODSelector selector;
+		selector.pixelsPerUnit = viewportHeight * 0.5f * projection[5];
+		selector.maxPixelError = maxPixelError;
+		return selector;
+	}
+
+	// distance is from the camera to the object's centre, scale the object's world scale
+	unsigned int select(const LODChain& chain, float distance, float scale = 1.0f) const
+	{
+		unsigned int level = 0;
+		float worldToPixels = pixelsPerUnit / (std::max)(distance, 1e-4f);
+		for (unsigned int i = 1; i < chain.levels.size(); i++)
+		{
+			if (chain.levels[i].error * chain.radius * scale * worldToPixels > maxPixelError)
+			{
+				break;
+			}
+			level = i;
+		}
+		return level;
+	}
+};
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+
+#include "SIMDConfig.h"
+#include "Frustum.h"
+#include "GEMLoader.h"
+
+// A small cluster of triangles that is culled as a unit. Its triangles are contiguous in the
+// mesh's index buffer, so a visible meshlet is submitted as one index range.
+struct Meshlet
+{
+	unsigned int vertexOffset = 0; // into MeshletMesh::vertices
+	unsigned int vertexCount = 0;
+	unsigned int firstIndex = 0;   // into the reordered index buffer
+	unsigned int indexCount = 0;
+	float center[3] = { 0, 0, 0 };
+	float radius = 0;
+	// Every triangle faces away from a viewer inside the cone around -coneAxis.
+	// coneCutoff is 1 when the normals spread too far for the cone to ever cull.
+	float coneAxis[3] = { 0, 0, 0 };
+	float coneCutoff = 1;
+};
+
+struct MeshletMesh
+{
+	std::vector<Meshlet> meshlets;
+	// Unique mesh vertices referenced by each meshlet, 64 at most per meshlet
+	std::vector<unsigned int> vertices;
+	unsigned int triangleCount = 0;
+
+	// Culling data in structure-of-arrays form, padded to a multiple of 4 with spheres that
+	// are always rejected
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> axisX, axisY, axisZ, cutoff;
+};
+
+struct IndexRange
+{
+	unsigned int firstIndex = 0;
+	unsigned int indexCount = 0;
+};
+
+struct MeshletCullStats
+{
+	unsigned int meshletsTotal = 0;
+	unsigned int meshletsVisible = 0;
+	unsigned int trianglesTotal = 0;
+	unsigned int trianglesSubmitted = 0;
+};
+
+// Splits an indexed triangle list into meshlets. Triangles are added greedily, preferring the
+// one that brings in the fewest new vertices and then the one closest to the meshlet centre.
+// Running MeshOptimizer first gives better locality and slightly fewer meshlets.
+class MeshletBuilder
+{
+public:
+	unsigned int maxVertices = 64;
+	unsigned int maxTriangles = 124;
+
+	// Reorders indices so each meshlet's triangles are contiguous. positions points at the first
+	// vertex's x, y, z floats. With normals, each triangle's facing follows its vertex normals,
+	// otherwise counter-clockwise triangles are taken to face the viewer.
+	MeshletMesh build(std::vector<unsigned int>& indices, const void* positions, size_t stride, unsigned int vertexCount, const void* normals = nullptr) const
+	{
+		MeshletMesh result;
+		unsigned int triangleCount = static_cast<unsigned int>(indices.size() / 3);
+		result.triangleCount = triangleCount;
+		if (triangleCount == 0)
+		{
+			finishSoA(result);
+			return result;
+		}
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+
+		// Vertex to triangle adjacency, same layout as MeshOptimizer
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			offsets[indices[i] + 1]++;
+		}
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		std::vector<unsigned int> adjacency(offsets[vertexCount]);
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (unsigned int t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				adjacency[fill[indices[t * 3 + k]]++] = t;
+			}
+		}
+		std::vector<float> triangleCentres(triangleCount * 3);
+		for (unsigned int t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				triangleCentres[t * 3 + k] = (position(indices[t * 3])[k] + position(indices[t * 3 + 1])[k] + position(indices[t * 3 + 2])[k]) / 3.0f;
+			}
+		}
+
+		std::vector<unsigned char> emitted(triangleCount, 0);
+		// stamp[v] == meshlet number + 1 when v is already in the current meshlet
+		std::vector<unsigned int> stamp(vertexCount, 0);
+		std::vector<unsigned int> output;
+		output.reserve(indices.size());
+		std::vector<unsigned int> meshletTriangles;
+		unsigned int cursor = 0;
+		unsigned int remaining = triangleCount;
+		while (remaining > 0)
+		{
+			Meshlet meshlet;
+			meshlet.vertexOffset = static_cast<unsigned int>(result.vertices.size());
+			meshlet.firstIndex = static_cast<unsigned int>(output.size());
+			unsigned int id = static_cast<unsigned int>(result.meshlets.size()) + 1;
+			meshletTriangles.clear();
+			float centroid[3] = { 0, 0, 0 };
+			while (meshletTriangles.size() < maxTriangles && remaining > 0)
+			{
+				unsigned int best = 0xFFFFFFFF;
+				unsigned int bestNew = 4;
+				float bestDistance = FLT_MAX;
+				for (unsigned int i = meshlet.vertexOffset; i < result.vertices.size(); i++)
+				{
+					unsigned int v = result.vertices[i];
+					for (unsigned int a = offsets[v]; a < offsets[v + 1]; a++)
+					{
+						unsigned int t = adjacency[a];
+						if (emitted[t])
+						{
+							continue;
+						}
+						unsigned int added = newVertices(indices, t, stamp, id);
+						float distance = 0;
+						for (int k = 0; k < 3; k++)
+						{
+							float d = triangleCentres[t * 3 + k] - centroid[k];
+							distance += d * d;
+						}
+						if (added < bestNew || (added == bestNew && distance < bestDistance))
+						{
+							best = t;
+							bestNew = added;
+							bestDistance = distance;
+						}
+					}
+				}
+				if (best == 0xFFFFFFFF)
+				{
+					// Nothing connected is left, start again from the next unused triangle
+					while (emitted[cursor])
+					{
+						cursor++;
+					}
+					best = cursor;
+					bestNew = newVertices(indices, best, stamp, id);
+				}
+				if (meshlet.vertexCount + bestNew > maxVertices)
+				{
+					break;
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int v = indices[best * 3 + k];
+					if (stamp[v] != id)
+					{
+						stamp[v] = id;
+						result.vertices.push_back(v);
+						meshlet.vertexCount++;
+					}
+					output.push_back(v);
+				}
+				emitted[best] = 1;
+				remaining--;
+				meshletTriangles.push_back(best);
+				for (int k = 0; k < 3; k++)
+				{
+					centroid[k] += (triangleCentres[best * 3 + k] - centroid[k]) / meshletTriangles.size();
+				}
+			}
+			meshlet.indexCount = static_cast<unsigned int>(output.size()) - meshlet.firstIndex;
+			computeBounds(meshlet, result.vertices, output, positions, stride, normals);
+			result.meshlets.push_back(meshlet);
+		}
+		indices.swap(output);
+		finishSoA(result);
+		return result;
+	}
+
+	MeshletMesh build(GEMLoader::GEMMesh& mesh) const
+	{
+		if (!mesh.verticesAnimated.empty())
+		{
+			return build(mesh.indices, &mesh.verticesAnimated[0].position, sizeof(GEMLoader::GEMAnimatedVertex), static_cast<unsigned int>(mesh.verticesAnimated.size()), &mesh.verticesAnimated[0].normal);
+		}
+		if (mesh.verticesStatic.empty())
+		{
+			return MeshletMesh();
+		}
+		return build(mesh.indices, &mesh.verticesStatic[0].position, sizeof(GEMLoader::GEMStaticVertex), static_cast<unsigned int>(mesh.verticesStatic.size()), &mesh.verticesStatic[0].normal);
+	}
+
+private:
+	static unsigned int newVertices(const std::vector<unsigned int>& indices, unsigned int t, const std::vector<unsigned int>& stamp, unsigned int id)
+	{
+		unsigned int a = indices[t * 3];
+		unsigned int b = indices[t * 3 + 1];
+		unsigned int c = indices[t * 3 + 2];
+		return (stamp[a] != id) + (stamp[b] != id && b != a) + (stamp[c] != id && c != a && c != b);
+	}
+
+	static void computeBounds(Meshlet& meshlet, const std::vector<unsigned int>& vertices, const std::vector<unsigned int>& indices, const void* positions, size_t stride, const void* normals)
+	{
+		auto position = [positions, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(positions) + v * stride);
+		};
+		auto normal = [normals, stride](unsigned int v)
+		{
+			return reinterpret_cast<const float*>(static_cast<const unsigned char*>(normals) + v * stride);
+		};
+
+		// Sphere around the box centre, looser than a minimal sphere but cheap and stable
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (unsigned int i = 0; i < meshlet.vertexCount; i++)
+		{
+			const float* p = position(vertices[meshlet.vertexOffset + i]);
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = fminf(lo[k], p[k]);
+				hi[k] = fmaxf(hi[k], p[k]);
+			}
+		}
+		float radiusSquared = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			meshlet.center[k] = (lo[k] + hi[k]) * 0.5f;
+		}
+		for (unsigned int i = 0; i < meshlet.vertexCount; i++)
+		{
+			const float* p = position(vertices[meshlet.vertexOffset + i]);
+			float dx = p[0] - meshlet.center[0];
+			float dy = p[1] - meshlet.center[1];
+			float dz = p[2] - meshlet.center[2];
+			radiusSquared = fmaxf(radiusSquared, dx * dx + dy * dy + dz * dz);
+		}
+		meshlet.radius = sqrtf(radiusSquared);
+
+		// Normal cone: average face normal, widened to the face that deviates most
+		std::vector<float> faceNormals;
+		faceNormals.reserve(meshlet.indexCount);
+		float axis[3] = { 0, 0, 0 };
+		for (unsigned int i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3)
+		{
+			const float* p0 = position(indices[i]);
+			const float* p1 = position(indices[i + 1]);
+			const float* p2 = position(indices[i + 2]);
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length == 0.0f)
+			{
+				continue;
+			}
+			if (normals)
+			{
+				float facing = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					facing += n[k] * (normal(indices[i])[k] + normal(indices[i + 1])[k] + normal(indices[i + 2])[k]);
+				}
+				if (facing < 0)
+				{
+					length = -length;
+				}
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				faceNormals.push_back(n[k] / length);
+				axis[k] += n[k] / length;
+			}
+		}
+		float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		meshlet.coneCutoff = 1;
+		if (axisLength == 0.0f)
+		{
+			return;
+		}
+		float minDot = 1;
+		for (int k = 0; k < 3; k++)
+		{
+			meshlet.coneAxis[k] = axis[k] / axisLength;
+		}
+		for (size_t i = 0; i < faceNormals.size(); i += 3)
+		{
+			float d = faceNormals[i] * meshlet.coneAxis[0] + faceNormals[i + 1] * meshlet.coneAxis[1] + faceNormals[i + 2] * meshlet.coneAxis[2];
+			minDot = fminf(minDot, d);
+		}
+		// Cones of 90 degrees or wider can always be seen from somewhere
+		if (minDot > 0.0f)
+		{
+			meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+		}
+	}
+
+	static void finishSoA(MeshletMesh& result)
+	{
+		size_t padded = (result.meshlets.size() + 3) & ~static_cast<size_t>(3);
+		// Padding spheres sit at the origin with a huge negative radius so every plane rejects them
+		result.centerX.assign(padded, 0.0f);
+		result.centerY.assign(padded, 0.0f);
+		result.centerZ.assign(padded, 0.0f);
+		result.radius.assign(padded, -FLT_MAX);
+		result.axisX.assign(padded, 0.0f);
+		result.axisY.assign(padded, 0.0f);
+		result.axisZ.assign(padded, 0.0f);
+		result.cutoff.assign(padded, 1.0f);
+		for (size_t i = 0; i < result.meshlets.size(); i++)
+		{
+			const Meshlet& m = result.meshlets[i];
+			result.centerX[i] = m.center[0];
+			result.centerY[i] = m.center[1];
+			result.centerZ[i] = m.center[2];
+			result.radius[i] = m.radius;
+			result.axisX[i] = m.coneAxis[0];
+			result.axisY[i] = m.coneAxis[1];
+			result.axisZ[i] = m.coneAxis[2];
+			result.cutoff[i] = m.coneCutoff;
+		}
+	}
+};
+
+// Rejects meshlets outside the frustum or facing entirely away from the camera, four at a time
+// with SSE2. The frustum and camera position must be in the same space as the mesh, so for a
+// transformed object build them from view * world.
+class MeshletCuller
+{
+public:
+	static MeshletCullStats cull(const MeshletMesh& mesh, const Frustum& frustum, const float* cameraPosition, std::vector<unsigned int>& visible)
+	{
+		visible.clear();
+		MeshletCullStats stats;
+		stats.meshletsTotal = static_cast<unsigned int>(mesh.meshlets.size());
+		stats.trianglesTotal = mesh.triangleCount;
+		size_t count = mesh.centerX.size();
+#if SIMD_SSE2
+		__m128 camX = _mm_set1_ps(cameraPosition[0]);
+		__m128 camY = _mm_set1_ps(cameraPosition[1]);
+		__m128 camZ = _mm_set1_ps(cameraPosition[2]);
+		for (size_t i = 0; i < count; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&mesh.centerX[i]);
+			__m128 cy = _mm_loadu_ps(&mesh.centerY[i]);
+			__m128 cz = _mm_loadu_ps(&mesh.centerZ[i]);
+			__m128 r = _mm_loadu_ps(&mesh.radius[i]);
+			__m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < Frustum::PlaneCount; p++)
+			{
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(frustum.planes[p][0])), _mm_mul_ps(cy, _mm_set1_ps(frustum.planes[p][1]))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(frustum.planes[p][2])), _mm_set1_ps(frustum.planes[p][3])));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+			}
+			__m128 dx = _mm_sub_ps(cx, camX);
+			__m128 dy = _mm_sub_ps(cy, camY);
+			__m128 dz = _mm_sub_ps(cz, camZ);
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+			__m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&mesh.axisX[i])), _mm_mul_ps(dy, _mm_loadu_ps(&mesh.axisY[i]))), _mm_mul_ps(dz, _mm_loadu_ps(&mesh.axisZ[i])));
+			__m128 backfacing = _mm_cmpge_ps(facing, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&mesh.cutoff[i]), length), r));
+			int mask = _mm_movemask_ps(_mm_andnot_ps(backfacing, inside));
+			while (mask)
+			{
+				int lane = lowestBit(mask);
+				mask &= mask - 1;
+				visible.push_back(static_cast<unsigned int>(i + lane));
+			}
+		}
+#else
+		for (size_t i = 0; i < mesh.meshlets.size(); i++)
+		{
+			if (isVisible(mesh.meshlets[i], frustum, cameraPosition))
+			{
+				visible.push_back(static_cast<unsigned int>(i));
+			}
+		}
+#endif
+		stats.meshletsVisible = static_cast<unsigned int>(visible.size());
+		for (size_t i = 0; i < visible.size(); i++)
+		{
+			stats.trianglesSubmitted += mesh.meshlets[visible[i]].indexCount / 3;
+		}
+		return stats;
+	}
+
+	// Scalar version of the test in cull()
+	static bool isVisible(const Meshlet& meshlet, const Frustum& frustum, const float* cameraPosition)
+	{
+		if (!frustum.intersectsSphere(meshlet.center, meshlet.radius))
+		{
+			return false;
+		}
+		float d[3] = { meshlet.center[0] - cameraPosition[0], meshlet.center[1] - cameraPosition[1], meshlet.center[2] - cameraPosition[2] };
+		float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		float facing = d[0] * meshlet.coneAxis[0] + d[1] * meshlet.coneAxis[1] + d[2] * meshlet.coneAxis[2];
+		return facing < meshlet.coneCutoff * length + meshlet.radius;
+	}
+
+	// Turns visible meshlets into index ranges, merging neighbours so runs of visible meshlets
+	// cost one draw
+	static void buildRanges(const MeshletMesh& mesh, const std::vector<unsigned int>& visible, std::vector<IndexRange>& ranges)
+	{
+		ranges.clear();
+		for (size_t i = 0; i < visible.size(); i++)
+		{
+			const Meshlet& m = mesh.meshlets[visible[i]];
+			if (!ranges.empty() && ranges.back().firstIndex + ranges.back().indexCount == m.firstIndex)
+			{
+				ranges.back().indexCount += m.indexCount;
+				continue;
+			}
+			IndexRange range;
+			range.firstIndex = m.firstIndex;
+			range.indexCount = m.indexCount;
+			ranges.push_back(range);
+		}
+	}
+
+private:
+	static int lowestBit(int mask)
+	{
+		int lane = 0;
+		while ((mask & 1) == 0)
+		{
+			mask >>= 1;
+			lane++;
+		}
+		return lane;
+	}
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <d3d11.h>
+#include <map>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstring>
+
+// Shares immutable rasterizer, blend and depth-stencil state objects. Descriptions are keyed
+// by a hash of their contents, so any number of objects asking for the same state get the
+// same handle. The cache owns every state it returns: do not Release them, call release()
+// once at shutdown.
+class PipelineStateCache
+{
+public:
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+
+	ID3D11RasterizerState* getRasterizerState(ID3D11Device* device, const D3D11_RASTERIZER_DESC& desc)
+	{
+		D3D11_RASTERIZER_DESC key = normalise(desc);
+		ID3D11RasterizerState* state = rasterizerStates.find(key);
+		if (state)
+		{
+			hits++;
+			return state;
+		}
+		misses++;
+		if (FAILED(device->CreateRasterizerState(&key, &state)))
+		{
+			throw std::runtime_error("Failed to create rasterizer state.");
+		}
+		rasterizerStates.insert(key, state);
+		return state;
+	}
+
+	ID3D11BlendState* getBlendState(ID3D11Device* device, const D3D11_BLEND_DESC& desc)
+	{
+		D3D11_BLEND_DESC key = normalise(desc);
+		ID3D11BlendState* state = blendStates.find(key);
+		if (state)
+		{
+			hits++;
+			return state;
+		}
+		misses++;
+		if (FAILED(device->CreateBlendState(&key, &state)))
+		{
+			throw std::runtime_error("Failed to create blend state.");
+		}
+		blendStates.insert(key, state);
+		return state;
+	}
+
+	ID3D11DepthStencilState* getDepthStencilState(ID3D11Device* device, const D3D11_DEPTH_STENCIL_DESC& desc)
+	{
+		D3D11_DEPTH_STENCIL_DESC key = normalise(desc);
+		ID3D11DepthStencilState* state = depthStencilStates.find(key);
+		if (state)
+		{
+			hits++;
+			return state;
+		}
+		misses++;
+		if (FAILED(device->CreateDepthStencilState(&key, &state)))
+		{
+			throw std::runtime_error("Failed to create depth stencil state.");
+		}
+		depthStencilStates.insert(key, state);
+		return state;
+	}
+
+	// Number of distinct state objects created
+	size_t size() const
+	{
+		return rasterizerStates.count + blendStates.count + depthStencilStates.count;
+	}
+
+	void release()
+	{
+		rasterizerStates.release();
+		blendStates.release();
+		depthStencilStates.release();
+	}
+
+private:
+	// Descriptions hashed as raw bytes, compared in full on a hash match
+	template<typename Desc, typename State>
+	struct Table
+	{
+		std::map<unsigned long long, std::vector<std::pair<Desc, State*>>> buckets;
+		size_t count = 0;
+
+		State* find(const Desc& desc)
+		{
+			auto it = buckets.find(hash(desc));
+			if (it == buckets.end())
+			{
+				return nullptr;
+			}
+			for (size_t i = 0; i < it->second.size(); i++)
+			{
+				if (memcmp(&it->second[i].first, &desc, sizeof(Desc)) == 0)
+				{
+					return it->second[i].second;
+				}
+			}
+			return nullptr;
+		}
+
+		void insert(const Desc& desc, State* state)
+		{
+			buckets[hash(desc)].push_back({ desc, state });
+			count++;
+		}
+
+		void release()
+		{
+			for (auto it = buckets.begin(); it != buckets.end(); ++it)
+			{
+				for (size_t i = 0; i < it->second.size(); i++)
+				{
+					it->second[i].second->Release();
+				}
+			}
+			buckets.clear();
+			count = 0;
+		}
+
+		static unsigned long long hash(const Desc& desc)
+		{
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&desc);
+			unsigned long long h = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(Desc); i++)
+			{
+				h = (h ^ bytes[i]) * 1099511628211ull;
+			}
+			return h;
+		}
+	};
+
+	Table<D3D11_RASTERIZER_DESC, ID3D11RasterizerState> rasterizerStates;
+	Table<D3D11_BLEND_DESC, ID3D11BlendState> blendStates;
+	Table<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState> depthStencilStates;
+
+	// Copies field by field into zeroed memory so padding bytes never affect the hash
+	static D3D11_RASTERIZER_DESC normalise(const D3D11_RASTERIZER_DESC& desc)
+	{
+		D3D11_RASTERIZER_DESC key;
+		memset(&key, 0, sizeof(key));
+		key.FillMode = desc.FillMode;
+		key.CullMode = desc.CullMode;
+		key.FrontCounterClockwise = desc.FrontCounterClockwise;
+		key.DepthBias = desc.DepthBias;
+		key.DepthBiasClamp = desc.DepthBiasClamp;
+		key.SlopeScaledDepthBias = desc.SlopeScaledDepthBias;
+		key.DepthClipEnable = desc.DepthClipEnable;
+		key.ScissorEnable = desc.ScissorEnable;
+		key.MultisampleEnable = desc.MultisampleEnable;
+		key.AntialiasedLineEnable = desc.AntialiasedLineEnable;
+		return key;
+	}
+
+	static D3D11_BLEND_DESC normalise(const D3D11_BLEND_DESC& desc)
+	{
+		D3D11_BLEND_DESC key;
+		memset(&key, 0, sizeof(key));
+		key.AlphaToCoverageEnable = desc.AlphaToCoverageEnable;
+		key.IndependentBlendEnable = desc.IndependentBlendEnable;
+		for (int i = 0; i < 8; i++)
+		{
+			key.RenderTarget[i].BlendEnable = desc.RenderTarget[i].BlendEnable;
+			key.RenderTarget[i].SrcBlend = desc.RenderTarget[i].SrcBlend;
+			key.RenderTarget[i].DestBlend = desc.RenderTarget[i].DestBlend;
+			key.RenderTarget[i].BlendOp = desc.RenderTarget[i].BlendOp;
+			key.RenderTarget[i].SrcBlendAlpha = desc.RenderTarget[i].SrcBlendAlpha;
+			key.RenderTarget[i].DestBlendAlpha = desc.RenderTarget[i].DestBlendAlpha;
+			key.RenderTarget[i].BlendOpAlpha = desc.RenderTarget[i].BlendOpAlpha;
+			key.RenderTarget[i].RenderTargetWriteMask = desc.RenderTarget[i].RenderTargetWriteMask;
+		}
+		return key;
+	}
+
+	static D3D11_DEPTH_STENCIL_DESC normalise(const D3D11_DEPTH_STENCIL_DESC& desc)
+	{
+		D3D11_DEPTH_STENCIL_DESC key;
+		memset(&key, 0, sizeof(key));
+		key.DepthEnable = desc.DepthEnable;
+		key.DepthWriteMask = desc.DepthWriteMask;
+		key.DepthFunc = desc.DepthFunc;
+		key.StencilEnable = desc.StencilEnable;
+		key.StencilReadMask = desc.StencilReadMask;
+		key.StencilWriteMask = desc.StencilWriteMask;
+		key.FrontFace = desc.FrontFace;
+		key.BackFace = desc.BackFace;
+		return key;
+	}
+};
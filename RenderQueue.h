@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+
+// Packs draw state into a 64-bit key so sorting the keys groups draws by state.
+//   opaque:      pass(4) | shader(12) | material(16) | depth(24) | unused(8)
+//   transparent: pass(4) | depth(24, far first) | shader(12) | material(16) | unused(8)
+// Opaque draws sort by state and then front to back inside each state group; transparent
+// draws must go back to front, so depth takes priority over state for them.
+struct SortKey
+{
+	static const unsigned int passBits = 4;
+	static const unsigned int shaderBits = 12;
+	static const unsigned int materialBits = 16;
+	static const unsigned int depthBits = 24;
+
+	// depth is view depth normalised to [0, 1], 0 at the near plane
+	static unsigned long long opaque(unsigned int pass, unsigned int shader, unsigned int material, float depth)
+	{
+		return (field(pass, passBits) << 60) | (field(shader, shaderBits) << 48) | (field(material, materialBits) << 32) | (quantiseDepth(depth) << 8);
+	}
+
+	static unsigned long long transparent(unsigned int pass, unsigned int shader, unsigned int material, float depth)
+	{
+		unsigned long long farFirst = ((1ull << depthBits) - 1) - quantiseDepth(depth);
+		return (field(pass, passBits) << 60) | (farFirst << 36) | (field(shader, shaderBits) << 24) | (field(material, materialBits) << 8);
+	}
+
+	static unsigned long long quantiseDepth(float depth)
+	{
+		depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+		return static_cast<unsigned long long>(depth * static_cast<float>((1u << depthBits) - 1));
+	}
+
+private:
+	static unsigned long long field(unsigned int value, unsigned int bits)
+	{
+		return static_cast<unsigned long long>(value & ((1u << bits) - 1));
+	}
+};
+
+// One draw. shader, material and mesh are indices the backend resolves; they are stored
+// outside the key so the backend never has to decode it.
+struct DrawPacket
+{
+	unsigned long long key = 0;
+	unsigned int shader = 0;
+	unsigned int material = 0;
+	unsigned int mesh = 0;
+	unsigned int subMesh = 0;
+};
+
+struct RenderQueueStats
+{
+	unsigned int draws = 0;
+	unsigned int shaderChanges = 0;
+	unsigned int materialChanges = 0;
+	unsigned int meshChanges = 0;
+
+	unsigned int stateChanges() const
+	{
+		return shaderChanges + materialChanges + meshChanges;
+	}
+};
+
+// Collects a frame's draws, radix sorts them by key and submits them to a backend, skipping
+// bindings that are already current. A backend provides
+//   void bindShader(unsigned int shader)
+//   void bindMaterial(unsigned int material)
+//   void bindMesh(unsigned int mesh)
+//   void draw(const DrawPacket& packet)
+class RenderQueue
+{
+public:
+	std::vector<DrawPacket> packets;
+
+	void reserve(size_t count)
+	{
+		packets.reserve(count);
+		entries.reserve(count);
+		scratch.reserve(count);
+	}
+
+	void push(const DrawPacket& packet)
+	{
+		packets.push_back(packet);
+		sorted = false;
+	}
+
+	void clear()
+	{
+		packets.clear();
+		entries.clear();
+		sorted = false;
+	}
+
+	// LSD radix sort on the keys, 8 bits per pass. Stable, so equal keys keep submission order.
+	// Passes where every key has the same byte are skipped, which is most of them for a
+	// typical frame with few passes and shaders.
+	void sort()
+	{
+		size_t count = packets.size();
+		entries.resize(count);
+		scratch.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			entries[i].key = packets[i].key;
+			entries[i].index = static_cast<unsigned int>(i);
+		}
+		// All eight histograms in one read of the keys
+		unsigned int histograms[8][256];
+		memset(histograms, 0, sizeof(histograms));
+		for (size_t i = 0; i < count; i++)
+		{
+			unsigned long long key = entries[i].key;
+			for (int b = 0; b < 8; b++)
+			{
+				histograms[b][(key >> (b * 8)) & 0xFF]++;
+			}
+		}
+		for (int b = 0; b < 8; b++)
+		{
+			unsigned int* histogram = histograms[b];
+			if (count == 0 || histogram[(entries[0].key >> (b * 8)) & 0xFF] == count)
+			{
+				continue;
+			}
+			unsigned int offset = 0;
+			for (int d = 0; d < 256; d++)
+			{
+				unsigned int n = histogram[d];
+				histogram[d] = offset;
+				offset += n;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				scratch[histogram[(entries[i].key >> (b * 8)) & 0xFF]++] = entries[i];
+			}
+			entries.swap(scratch);
+		}
+		sorted = true;
+	}
+
+	// Submits in sorted order if sort() was called since the last push, otherwise as pushed
+	template<typename Backend>
+	RenderQueueStats submit(Backend& backend) const
+	{
+		RenderQueueStats stats;
+		const unsigned int none = 0xFFFFFFFF;
+		unsigned int shader = none;
+		unsigned int material = none;
+		unsigned int mesh = none;
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			const DrawPacket& packet = sorted ? packets[entries[i].index] : packets[i];
+			if (packet.shader != shader)
+			{
+				shader = packet.shader;
+				backend.bindShader(shader);
+				stats.shaderChanges++;
+			}
+			if (packet.material != material)
+			{
+				material = packet.material;
+				backend.bindMaterial(material);
+				stats.materialChanges++;
+			}
+			if (packet.mesh != mesh)
+			{
+				mesh = packet.mesh;
+				backend.bindMesh(mesh);
+				stats.meshChanges++;
+			}
+			backend.draw(packet);
+			stats.draws++;
+		}
+		return stats;
+	}
+
+private:
+	struct Entry
+	{
+		unsigned long long key;
+		unsigned int index;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+	bool sorted = false;
+};
+
+// Backend that only records the commands, for measuring a queue without a device
+class RecordingRenderBackend
+{
+public:
+	enum CommandType
+	{
+		BindShader,
+		BindMaterial,
+		BindMesh,
+		Draw
+	};
+
+	struct Command
+	{
+		CommandType type;
+		unsigned int value;
+	};
+
+	std::vector<Command> commands;
+
+	void bindShader(unsigned int shader)
+	{
+		commands.push_back({ BindShader, shader });
+	}
+
+	void bindMaterial(unsigned int material)
+	{
+		commands.push_back({ BindMaterial, material });
+	}
+
+	void bindMesh(unsigned int mesh)
+	{
+		commands.push_back({ BindMesh, mesh });
+	}
+
+	void draw(const DrawPacket& packet)
+	{
+		commands.push_back({ Draw, packet.subMesh });
+	}
+};
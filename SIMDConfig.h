@@ -0,0 +1,22 @@
+#pragma once
+
+// Which x86 vector extensions the compiler may use. Code paths guarded by these macros always
+// have a scalar fallback, so every platform builds.
+//   SIMD_SSE2 - always on x64 (MSVC and GCC/Clang), on x86 with /arch:SSE2 or -msse2
+//   SIMD_AVX  - /arch:AVX or higher, or -mavx
+//   SIMD_F16C - half float conversion instructions, /arch:AVX2 or -mf16c
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define SIMD_AVX 1
+#include <immintrin.h>
+#endif
+
+#if defined(__F16C__) || defined(__AVX2__)
+#define SIMD_F16C 1
+#include <immintrin.h>
+#endif
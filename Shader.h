@@ -10,6 +10,9 @@
 #include <windows.h>
 #include "Core.h"
 #include "ShaderPeflection.h"
+#include "ConstantBufferRing.h"
+#include "ShaderCache.h"
+#include "ShaderCompiler.h"
 
 class Shader {
 public:
@@ -22,6 +25,23 @@ public:
     std::map<std::string, int> textureBindPointsVS;
     std::map<std::string, int> textureBindPointsPS;
 
+    // 设置后，常量缓冲区按名称和布局在所有着色器、所有阶段之间共享
+    ConstantBufferRegistry* registry = nullptr;
+    std::vector<ConstantBufferBinding> sharedConstantBuffers;
+
+    // 设置后，编译结果和反射数据缓存到磁盘，再次启动时跳过编译和反射
+    ShaderCache* cache = nullptr;
+
+    // 编译时传给 D3DCompile 的宏定义
+    ShaderDefines defines;
+
+    // 从源码加载时使用的入口函数，重新编译时沿用
+    std::string vsEntryPoint = "VS";
+    std::string psEntryPoint = "PS";
+
+    // 创建输入布局时使用的函数，重新加载时沿用
+    void (Shader::* inputLayoutFunc)(ID3DBlob*, Core*) = nullptr;
+
     // 读取着色器代码
     std::string loadShaderCode(const std::string& filename) {
         std::ifstream file(filename);
@@ -33,95 +53,169 @@ public:
         return buffer.str();
     }
 
-    // 加载顶点着色器并反射
-    void loadVS(Core* core, const std::string& hlslCode, void (Shader::* layoutFunc)(ID3DBlob*, Core*) = nullptr) {
+    // 使用 D3DCompile 编译并反射，结果写入可缓存的 ShaderCacheEntry
+    static void compileD3D(const std::string& hlslCode, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines, ShaderCacheEntry& entry) {
         ID3DBlob* shaderBlob = nullptr;
         ID3DBlob* errorBlob = nullptr;
 
+        std::vector<D3D_SHADER_MACRO> macros;
+        for (size_t i = 0; i < defines.size(); i++) {
+            macros.push_back({ defines[i].first.c_str(), defines[i].second.c_str() });
+        }
+        macros.push_back({ NULL, NULL });
+
         HRESULT hr = D3DCompile(
             hlslCode.c_str(),
             hlslCode.size(),
-            NULL, NULL, NULL,
-            "VS", "vs_5_0",
+            NULL, macros.data(), NULL,
+            entryPoint.c_str(), profile.c_str(),
             0, 0,
             &shaderBlob,
             &errorBlob
         );
 
+        std::string stageName = profile[0] == 'v' ? "Vertex Shader" : "Pixel Shader";
         if (FAILED(hr)) {
             if (errorBlob) {
                 std::string errorMsg = (char*)errorBlob->GetBufferPointer();
                 errorBlob->Release();
-                throw std::runtime_error("Vertex Shader Compilation Error: " + errorMsg);
+                throw std::runtime_error(stageName + " Compilation Error: " + errorMsg);
             }
-            throw std::runtime_error("Failed to compile vertex shader.");
+            throw std::runtime_error("Failed to compile " + stageName + ".");
+        }
+
+        unsigned char* bytes = (unsigned char*)shaderBlob->GetBufferPointer();
+        entry.bytecode.assign(bytes, bytes + shaderBlob->GetBufferSize());
+
+        ConstantBufferReflection reflection;
+        reflection.reflect(shaderBlob, entry.constantBuffers, entry.textureBindPoints);
+
+        shaderBlob->Release();
+    }
+
+    // 编译着色器，设置了缓存时优先从磁盘读取字节码和反射结果
+    void compile(const std::string& hlslCode, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines, ShaderCacheEntry& entry) {
+        if (cache) {
+            cache->getOrCompile(hlslCode, entryPoint, profile, defines, &Shader::compileD3D, entry);
         }
+        else {
+            compileD3D(hlslCode, entryPoint, profile, defines, entry);
+        }
+    }
 
-        hr = core->device->CreateVertexShader(
-            shaderBlob->GetBufferPointer(),
-            shaderBlob->GetBufferSize(),
+    // 根据反射结果创建常量缓冲区
+    void createConstantBuffers(Core* core, const ShaderCacheEntry& entry, ShaderStage stage) {
+        ConstantBufferReflection reflection;
+        if (registry) {
+            reflection.build(core, entry.constantBuffers, *registry, sharedConstantBuffers, stage);
+        }
+        else {
+            reflection.build(core, entry.constantBuffers, stage == ShaderStage::VertexShader ? vsConstantBuffers : psConstantBuffers, stage);
+        }
+        std::map<std::string, int>& textureBindPoints = stage == ShaderStage::VertexShader ? textureBindPointsVS : textureBindPointsPS;
+        textureBindPoints.insert(entry.textureBindPoints.begin(), entry.textureBindPoints.end());
+    }
+
+    // 加载顶点着色器并反射
+    void loadVS(Core* core, const std::string& hlslCode, void (Shader::* layoutFunc)(ID3DBlob*, Core*) = nullptr) {
+        ShaderCacheEntry entry;
+        compile(hlslCode, vsEntryPoint, "vs_5_0", defines, entry);
+        loadVS(core, entry, layoutFunc);
+    }
+
+    // 从已编译的结果创建顶点着色器
+    void loadVS(Core* core, const ShaderCacheEntry& entry, void (Shader::* layoutFunc)(ID3DBlob*, Core*) = nullptr) {
+        HRESULT hr = core->device->CreateVertexShader(
+            entry.bytecode.data(),
+            entry.bytecode.size(),
             NULL,
             &vertexShader
         );
 
         if (FAILED(hr)) {
-            shaderBlob->Release();
             throw std::runtime_error("Failed to create vertex shader.");
         }
 
         // 创建输入布局
+        inputLayoutFunc = layoutFunc;
         if (layoutFunc) {
+            ID3DBlob* shaderBlob = nullptr;
+            D3DCreateBlob(entry.bytecode.size(), &shaderBlob);
+            memcpy(shaderBlob->GetBufferPointer(), entry.bytecode.data(), entry.bytecode.size());
             (this->*layoutFunc)(shaderBlob, core);
+            shaderBlob->Release();
         }
 
         // 反射顶点着色器常量缓冲区
-        ConstantBufferReflection reflection;
-        reflection.build(core, shaderBlob, vsConstantBuffers, textureBindPointsVS, ShaderStage::VertexShader);
-
-        shaderBlob->Release();
+        createConstantBuffers(core, entry, ShaderStage::VertexShader);
     }
 
     // 加载像素着色器并反射
     void loadPS(Core* core, const std::string& hlslCode) {
-        ID3DBlob* shaderBlob = nullptr;
-        ID3DBlob* errorBlob = nullptr;
-
-        HRESULT hr = D3DCompile(
-            hlslCode.c_str(),
-            hlslCode.size(),
-            NULL, NULL, NULL,
-            "PS", "ps_5_0",
-            0, 0,
-            &shaderBlob,
-            &errorBlob
-        );
-
-        if (FAILED(hr)) {
-            if (errorBlob) {
-                std::string errorMsg = (char*)errorBlob->GetBufferPointer();
-                errorBlob->Release();
-                throw std::runtime_error("Pixel Shader Compilation Error: " + errorMsg);
-            }
-            throw std::runtime_error("Failed to compile pixel shader.");
-        }
+        ShaderCacheEntry entry;
+        compile(hlslCode, psEntryPoint, "ps_5_0", defines, entry);
+        loadPS(core, entry);
+    }
 
-        hr = core->device->CreatePixelShader(
-            shaderBlob->GetBufferPointer(),
-            shaderBlob->GetBufferSize(),
+    // 从已编译的结果创建像素着色器
+    void loadPS(Core* core, const ShaderCacheEntry& entry) {
+        HRESULT hr = core->device->CreatePixelShader(
+            entry.bytecode.data(),
+            entry.bytecode.size(),
             NULL,
             &pixelShader
         );
 
         if (FAILED(hr)) {
-            shaderBlob->Release();
             throw std::runtime_error("Failed to create pixel shader.");
         }
 
         // 反射像素着色器常量缓冲区
-        ConstantBufferReflection reflection;
-        reflection.build(core, shaderBlob, psConstantBuffers, textureBindPointsPS,ShaderStage::PixelShader);
+        createConstantBuffers(core, entry, ShaderStage::PixelShader);
+    }
 
-        shaderBlob->Release();
+    // 批量加载：所有着色器在线程池上并行编译和反射，设备对象在调用线程上依次创建
+    struct ManifestEntry {
+        std::string vsCode;
+        std::string psCode;
+        void (Shader::* layoutFunc)(ID3DBlob*, Core*) = nullptr;
+        std::string vsEntryPoint = "VS";
+        std::string psEntryPoint = "PS";
+    };
+
+    static void loadBatch(Core* core, std::vector<Shader>& shaders, const std::vector<ManifestEntry>& manifest, ThreadPool& pool, ShaderCache* cache = nullptr) {
+        ShaderBatchCompiler compiler;
+        compiler.init(&pool, &Shader::compileD3D, cache);
+
+        std::vector<std::future<ShaderCacheEntry>> vsResults;
+        std::vector<std::future<ShaderCacheEntry>> psResults;
+        for (size_t i = 0; i < manifest.size(); i++) {
+            vsResults.push_back(compiler.submit({ manifest[i].vsCode, manifest[i].vsEntryPoint, "vs_5_0", ShaderDefines() }));
+            psResults.push_back(compiler.submit({ manifest[i].psCode, manifest[i].psEntryPoint, "ps_5_0", ShaderDefines() }));
+        }
+
+        shaders.resize(manifest.size());
+        for (size_t i = 0; i < manifest.size(); i++) {
+            shaders[i].vsEntryPoint = manifest[i].vsEntryPoint;
+            shaders[i].psEntryPoint = manifest[i].psEntryPoint;
+            shaders[i].loadVS(core, vsResults[i].get(), manifest[i].layoutFunc);
+            shaders[i].loadPS(core, psResults[i].get());
+        }
+    }
+
+    // 实例化输入布局：Vertex 从槽位 0 逐顶点读取，Instance 从槽位 1 逐实例读取
+    template<typename Vertex, typename Instance>
+    void instancedInputLayout(ID3DBlob* compiledVertexShader, Core* core) {
+        std::vector<D3D11_INPUT_ELEMENT_DESC> layoutDesc;
+        appendInputElements<Vertex>(layoutDesc, 0);
+        appendInputElements<Instance>(layoutDesc, 1, D3D11_INPUT_PER_INSTANCE_DATA, 1);
+        layout = core->inputLayouts.get(
+            core->device,
+            layoutDesc.data(),
+            static_cast<unsigned int>(layoutDesc.size()),
+            compiledVertexShader->GetBufferPointer(),
+            compiledVertexShader->GetBufferSize()
+        );
     }
 
     // 输入布局示例（可动态选择）
@@ -131,24 +225,56 @@ public:
             { "COLOUR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
         };
 
-        HRESULT hr = core->device->CreateInputLayout(
+        layout = core->inputLayouts.get(
+            core->device,
             layoutDesc,
             2,
             compiledVertexShader->GetBufferPointer(),
-            compiledVertexShader->GetBufferSize(),
-            &layout
+            compiledVertexShader->GetBufferSize()
         );
+    }
 
-        if (FAILED(hr)) {
-            throw std::runtime_error("Failed to create input layout.");
-        }
+    // 由 VERTEX_FORMAT 描述的顶点结构生成输入布局，例如 shader.loadVS(core, code, &Shader::inputLayout<Vertex>)
+    template<typename T>
+    void inputLayout(ID3DBlob* compiledVertexShader, Core* core) {
+        layout = core->inputLayouts.get<T>(
+            core->device,
+            compiledVertexShader->GetBufferPointer(),
+            compiledVertexShader->GetBufferSize()
+        );
     }
 
-    // 绑定着色器及其常量缓冲区
-    void bind(Core* core) {
-        core->deviceContext->VSSetShader(vertexShader, NULL, 0);
-        core->deviceContext->PSSetShader(pixelShader, NULL, 0);
-        core->deviceContext->IASetInputLayout(layout);
+    // 绑定着色器及其常量缓冲区（传入 ring 时常量数据写入每帧环形缓冲区并按偏移绑定）
+    void bind(Core* core, ConstantBufferRing* ring = nullptr) {
+        core->setVertexShader(vertexShader);
+        core->setPixelShader(pixelShader);
+        core->setInputLayout(layout);
+
+        if (ring && ring->offsetBinding) {
+            // 先写入全部切片，只解除映射一次，再按偏移绑定。
+            // 未改变的缓冲区沿用本帧已写入的切片，共享缓冲区每帧只写一次，各阶段绑定同一偏移
+            for (size_t i = 0; i < vsConstantBuffers.size(); i++) {
+                ring->write(core, vsConstantBuffers[i]);
+            }
+            for (size_t i = 0; i < psConstantBuffers.size(); i++) {
+                ring->write(core, psConstantBuffers[i]);
+            }
+            for (size_t i = 0; i < sharedConstantBuffers.size(); i++) {
+                ring->write(core, *sharedConstantBuffers[i].buffer);
+            }
+            ring->unmap(core);
+            for (size_t i = 0; i < vsConstantBuffers.size(); i++) {
+                ring->bind(core, ShaderStage::VertexShader, vsConstantBuffers[i].index, vsConstantBuffers[i].ringSlice);
+            }
+            for (size_t i = 0; i < psConstantBuffers.size(); i++) {
+                ring->bind(core, ShaderStage::PixelShader, psConstantBuffers[i].index, psConstantBuffers[i].ringSlice);
+            }
+            for (size_t i = 0; i < sharedConstantBuffers.size(); i++) {
+                ConstantBufferBinding& binding = sharedConstantBuffers[i];
+                ring->bind(core, binding.stage, binding.slot, binding.buffer->ringSlice);
+            }
+            return;
+        }
 
         // 绑定顶点着色器的常量缓冲区
         for (size_t i = 0; i < vsConstantBuffers.size(); i++) {
@@ -159,6 +285,59 @@ public:
         for (size_t i = 0; i < psConstantBuffers.size(); i++) {
             psConstantBuffers[i].upload(core);
         }
+
+        // 共享常量缓冲区：数据只在改变时上传一次，然后绑定到每个使用它的阶段
+        for (size_t i = 0; i < sharedConstantBuffers.size(); i++) {
+            ConstantBufferBinding& binding = sharedConstantBuffers[i];
+            binding.buffer->commit(core);
+            core->setConstantBuffer(binding.stage, binding.slot, binding.buffer->cb);
+        }
+    }
+
+    // 用新编译的结果替换当前着色器。新对象全部创建成功后才替换，失败时抛出异常并保留旧着色器。
+    // 布局未改变的常量缓冲区保留原有的 CPU 数据。
+    void reload(Core* core, const ShaderCacheEntry& vsEntry, const ShaderCacheEntry& psEntry) {
+        Shader fresh;
+        fresh.registry = registry;
+        fresh.cache = cache;
+        fresh.defines = defines;
+        fresh.vsEntryPoint = vsEntryPoint;
+        fresh.psEntryPoint = psEntryPoint;
+        try {
+            fresh.loadVS(core, vsEntry, inputLayoutFunc);
+            fresh.loadPS(core, psEntry);
+        }
+        catch (...) {
+            fresh.release();
+            for (size_t i = 0; i < fresh.vsConstantBuffers.size(); i++) fresh.vsConstantBuffers[i].free();
+            for (size_t i = 0; i < fresh.psConstantBuffers.size(); i++) fresh.psConstantBuffers[i].free();
+            throw;
+        }
+
+        // 共享缓冲区由 registry 按名称和布局去重，布局相同时自然得到原来的实例
+        keepShadowData(vsConstantBuffers, fresh.vsConstantBuffers);
+        keepShadowData(psConstantBuffers, fresh.psConstantBuffers);
+
+        release();
+        for (size_t i = 0; i < vsConstantBuffers.size(); i++) vsConstantBuffers[i].free();
+        for (size_t i = 0; i < psConstantBuffers.size(); i++) psConstantBuffers[i].free();
+        *this = fresh;
+
+        // 旧对象可能仍然绑定在上下文上，地址也可能被新对象复用
+        core->invalidateStateCache();
+    }
+
+    static void keepShadowData(const std::vector<ConstantBuffer>& oldBuffers, std::vector<ConstantBuffer>& newBuffers) {
+        for (size_t i = 0; i < newBuffers.size(); i++) {
+            unsigned int layoutHash = newBuffers[i].computeLayoutHash();
+            for (size_t n = 0; n < oldBuffers.size(); n++) {
+                if (oldBuffers[n].name == newBuffers[i].name && oldBuffers[n].computeLayoutHash() == layoutHash) {
+                    memcpy(newBuffers[i].buffer, oldBuffers[n].buffer, newBuffers[i].cbSizeInBytes);
+                    newBuffers[i].markDirty(0, newBuffers[i].cbSizeInBytes);
+                    break;
+                }
+            }
+        }
     }
 
     // 释放资源
@@ -167,4 +346,104 @@ public:
         if (pixelShader) pixelShader->Release();
         if (layout) layout->Release();
     }
+};
+// 着色器变体：每个功能开关对应一个 #define，变体在第一次使用时才编译并缓存
+typedef unsigned int ShaderPermutationKey;
+
+class ShaderPermutations {
+public:
+    std::string vsCode;
+    std::string psCode;
+    std::vector<std::string> features; // 第 i 位对应 #define features[i] 1
+    void (Shader::* layoutFunc)(ID3DBlob*, Core*) = nullptr;
+    ConstantBufferRegistry* registry = nullptr;
+    ShaderCache* cache = nullptr;
+    std::string vsEntryPoint = "VS";
+    std::string psEntryPoint = "PS";
+
+    std::map<ShaderPermutationKey, Shader> variants;
+    std::map<ShaderPermutationKey, std::pair<std::future<ShaderCacheEntry>, std::future<ShaderCacheEntry>>> pending;
+
+    void init(const std::string& vertexCode, const std::string& pixelCode, const std::vector<std::string>& featureNames, void (Shader::* inputLayoutFunc)(ID3DBlob*, Core*) = nullptr) {
+        if (featureNames.size() > 32) {
+            throw std::runtime_error("Too many shader features for a permutation key.");
+        }
+        vsCode = vertexCode;
+        psCode = pixelCode;
+        features = featureNames;
+        layoutFunc = inputLayoutFunc;
+    }
+
+    ShaderPermutationKey featureBit(const std::string& name) const {
+        for (size_t i = 0; i < features.size(); i++) {
+            if (features[i] == name) return 1u << i;
+        }
+        throw std::runtime_error("Unknown shader feature: " + name);
+    }
+
+    ShaderDefines definesFor(ShaderPermutationKey key) const {
+        ShaderDefines defines;
+        for (size_t i = 0; i < features.size(); i++) {
+            if (key & (1u << i)) defines.push_back({ features[i], "1" });
+        }
+        return defines;
+    }
+
+    // 后台预编译一组常用变体，get 时再在调用线程上创建设备对象
+    void precompile(ThreadPool& pool, const std::vector<ShaderPermutationKey>& keys) {
+        ShaderBatchCompiler compiler;
+        compiler.init(&pool, &Shader::compileD3D, cache);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (variants.count(keys[i]) || pending.count(keys[i])) continue;
+            ShaderDefines defines = definesFor(keys[i]);
+            pending[keys[i]] = std::make_pair(
+                compiler.submit({ vsCode, vsEntryPoint, "vs_5_0", defines }),
+                compiler.submit({ psCode, psEntryPoint, "ps_5_0", defines }));
+        }
+    }
+
+    Shader& get(Core* core, ShaderPermutationKey key) {
+        auto it = variants.find(key);
+        if (it != variants.end()) return it->second;
+
+        // 两个阶段都加载成功后才放入 variants，失败时不留下半初始化的变体
+        Shader shader;
+        shader.registry = registry;
+        shader.cache = cache;
+        shader.defines = definesFor(key);
+        shader.vsEntryPoint = vsEntryPoint;
+        shader.psEntryPoint = psEntryPoint;
+        try {
+            auto job = pending.find(key);
+            if (job != pending.end()) {
+                std::pair<std::future<ShaderCacheEntry>, std::future<ShaderCacheEntry>> results = std::move(job->second);
+                pending.erase(job);
+                shader.loadVS(core, results.first.get(), layoutFunc);
+                shader.loadPS(core, results.second.get());
+            }
+            else {
+                shader.loadVS(core, vsCode, layoutFunc);
+                shader.loadPS(core, psCode);
+            }
+        }
+        catch (...) {
+            shader.release();
+            for (size_t i = 0; i < shader.vsConstantBuffers.size(); i++) shader.vsConstantBuffers[i].free();
+            for (size_t i = 0; i < shader.psConstantBuffers.size(); i++) shader.psConstantBuffers[i].free();
+            throw;
+        }
+        return variants.emplace(key, std::move(shader)).first->second;
+    }
+
+    void release() {
+        for (auto it = variants.begin(); it != variants.end(); ++it) {
+            it->second.release();
+        }
+        variants.clear();
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            it->second.first.wait();
+            it->second.second.wait();
+        }
+        pending.clear();
+    }
 };
\ No newline at end of file
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <filesystem>
+#include <atomic>
+#include <thread>
+
+#include "ConstantBufferParser.h"
+
+// Compiled bytecode plus everything reflection would tell us about it
+struct ShaderCacheEntry
+{
+	std::vector<unsigned char> bytecode;
+	std::vector<ParsedConstantBuffer> constantBuffers;
+	std::map<std::string, int> textureBindPoints;
+};
+
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+// Fills in an entry on a cache miss. Throws on compile errors.
+typedef std::function<void(const std::string& source, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines, ShaderCacheEntry& entry)> ShaderCompileFunction;
+
+// Content-addressed on-disk cache of compiled shaders. The file name is a hash of the source,
+// entry point, profile, defines and cache format, so any change to those is a miss and old
+// files are simply never read again. Safe to use from several compile threads at once.
+class ShaderCache
+{
+public:
+	static constexpr unsigned int magic = 0x43485347; // "GSHC"
+	static constexpr unsigned int version = 1;
+	std::string directory;
+	std::atomic<unsigned long long> hits{ 0 };
+	std::atomic<unsigned long long> misses{ 0 };
+
+	void init(const std::string& cacheDirectory)
+	{
+		directory = cacheDirectory;
+		std::filesystem::create_directories(directory);
+	}
+
+	static unsigned long long computeKey(const std::string& source, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		auto mix = [&hash](const std::string& s)
+		{
+			for (size_t i = 0; i < s.size(); i++)
+			{
+				hash = (hash ^ static_cast<unsigned char>(s[i])) * 1099511628211ull;
+			}
+			// Separator so "ab"+"c" and "a"+"bc" hash differently
+			hash = (hash ^ 0xFF) * 1099511628211ull;
+		};
+		mix(source);
+		mix(entryPoint);
+		mix(profile);
+		for (size_t i = 0; i < defines.size(); i++)
+		{
+			mix(defines[i].first);
+			mix(defines[i].second);
+		}
+		mix(std::to_string(version));
+		return hash;
+	}
+
+	std::string pathFor(unsigned long long key) const
+	{
+		std::stringstream ss;
+		ss << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".shc";
+		return ss.str();
+	}
+
+	// Returns false on a miss or if the file is damaged
+	bool load(unsigned long long key, ShaderCacheEntry& entry)
+	{
+		std::ifstream file(pathFor(key), std::ios::binary);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		unsigned int fileMagic = 0;
+		unsigned int fileVersion = 0;
+		unsigned long long fileKey = 0;
+		readValue(file, fileMagic);
+		readValue(file, fileVersion);
+		readValue(file, fileKey);
+		if (!file || fileMagic != magic || fileVersion != version || fileKey != key)
+		{
+			return false;
+		}
+		ShaderCacheEntry loaded;
+		unsigned int n = 0;
+		readValue(file, n);
+		if (!file || n > (1u << 28))
+		{
+			return false;
+		}
+		loaded.bytecode.resize(n);
+		file.read(reinterpret_cast<char*>(loaded.bytecode.data()), n);
+		readValue(file, n);
+		for (unsigned int i = 0; i < n && file; i++)
+		{
+			ParsedConstantBuffer cb;
+			cb.name = readString(file);
+			readValue(file, cb.registerIndex);
+			readValue(file, cb.size);
+			unsigned int variables = 0;
+			readValue(file, variables);
+			for (unsigned int v = 0; v < variables && file; v++)
+			{
+				ParsedConstantBufferVariable var = {};
+				var.name = readString(file);
+				readValue(file, var.offset);
+				readValue(file, var.size);
+				cb.variables.push_back(var);
+			}
+			loaded.constantBuffers.push_back(cb);
+		}
+		readValue(file, n);
+		for (unsigned int i = 0; i < n && file; i++)
+		{
+			std::string name = readString(file);
+			int bindPoint = 0;
+			readValue(file, bindPoint);
+			loaded.textureBindPoints.insert({ name, bindPoint });
+		}
+		if (!file)
+		{
+			return false;
+		}
+		entry = loaded;
+		return true;
+	}
+
+	void store(unsigned long long key, const ShaderCacheEntry& entry)
+	{
+		// Write to a temporary file and rename, so a crash never leaves a half-written entry
+		std::string path = pathFor(key);
+		std::stringstream temporary;
+		temporary << path << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+		bool written = false;
+		{
+			std::ofstream file(temporary.str(), std::ios::binary);
+			if (!file.is_open())
+			{
+				return;
+			}
+			writeValue(file, magic);
+			writeValue(file, version);
+			writeValue(file, key);
+			writeValue(file, static_cast<unsigned int>(entry.bytecode.size()));
+			file.write(reinterpret_cast<const char*>(entry.bytecode.data()), entry.bytecode.size());
+			writeValue(file, static_cast<unsigned int>(entry.constantBuffers.size()));
+			for (size_t i = 0; i < entry.constantBuffers.size(); i++)
+			{
+				const ParsedConstantBuffer& cb = entry.constantBuffers[i];
+				writeString(file, cb.name);
+				writeValue(file, cb.registerIndex);
+				writeValue(file, cb.size);
+				writeValue(file, static_cast<unsigned int>(cb.variables.size()));
+				for (size_t v = 0; v < cb.variables.size(); v++)
+				{
+					writeString(file, cb.variables[v].name);
+					writeValue(file, cb.variables[v].offset);
+					writeValue(file, cb.variables[v].size);
+				}
+			}
+			writeValue(file, static_cast<unsigned int>(entry.textureBindPoints.size()));
+			for (auto it = entry.textureBindPoints.begin(); it != entry.textureBindPoints.end(); ++it)
+			{
+				writeString(file, it->first);
+				writeValue(file, it->second);
+			}
+			file.close();
+			written = !file.fail();
+		}
+		// The cache is only an optimisation, a failed store leaves nothing behind and is not an error
+		std::error_code ec;
+		if (written)
+		{
+			std::filesystem::rename(temporary.str(), path, ec);
+		}
+		if (!written || ec)
+		{
+			std::filesystem::remove(temporary.str(), ec);
+		}
+	}
+
+	// Loads the entry from disk, or compiles and stores it
+	void getOrCompile(const std::string& source, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines, const ShaderCompileFunction& compile, ShaderCacheEntry& entry)
+	{
+		unsigned long long key = computeKey(source, entryPoint, profile, defines);
+		if (load(key, entry))
+		{
+			hits++;
+			return;
+		}
+		misses++;
+		compile(source, entryPoint, profile, defines, entry);
+		store(key, entry);
+	}
+
+private:
+	template<typename T>
+	static void readValue(std::ifstream& file, T& value)
+	{
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+	}
+	template<typename T>
+	static void writeValue(std::ofstream& file, const T& value)
+	{
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	static std::string readString(std::ifstream& file)
+	{
+		unsigned int l = 0;
+		readValue(file, l);
+		if (!file || l > 65536)
+		{
+			file.setstate(std::ios::failbit);
+			return std::string();
+		}
+		std::string s(l, '\0');
+		file.read(&s[0], l);
+		return s;
+	}
+	static void writeString(std::ofstream& file, const std::string& s)
+	{
+		writeValue(file, static_cast<unsigned int>(s.size()));
+		file.write(s.data(), s.size());
+	}
+};
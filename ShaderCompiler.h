@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <future>
+
+#include "ShaderCache.h"
+#include "ThreadPool.h"
+
+// One shader stage to compile
+struct ShaderCompileJob
+{
+	std::string source;
+	std::string entryPoint;
+	std::string profile;
+	ShaderDefines defines;
+};
+
+// Compiles and reflects shaders on a thread pool. Only the compile function runs on the
+// workers, device objects are created afterwards by the caller from the returned entries.
+class ShaderBatchCompiler
+{
+public:
+	ThreadPool* pool = nullptr;
+	ShaderCache* cache = nullptr;
+	ShaderCompileFunction compile;
+
+	void init(ThreadPool* threadPool, const ShaderCompileFunction& compileFunction, ShaderCache* shaderCache = nullptr)
+	{
+		pool = threadPool;
+		compile = compileFunction;
+		cache = shaderCache;
+	}
+
+	std::future<ShaderCacheEntry> submit(const ShaderCompileJob& job)
+	{
+		ShaderCompileFunction compileFunction = compile;
+		ShaderCache* shaderCache = cache;
+		return pool->submit([job, compileFunction, shaderCache]()
+		{
+			ShaderCacheEntry entry;
+			if (shaderCache)
+			{
+				shaderCache->getOrCompile(job.source, job.entryPoint, job.profile, job.defines, compileFunction, entry);
+			} else
+			{
+				compileFunction(job.source, job.entryPoint, job.profile, job.defines, entry);
+			}
+			return entry;
+		});
+	}
+
+	std::vector<std::future<ShaderCacheEntry>> submit(const std::vector<ShaderCompileJob>& jobs)
+	{
+		std::vector<std::future<ShaderCacheEntry>> results;
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			results.push_back(submit(jobs[i]));
+		}
+		return results;
+	}
+};
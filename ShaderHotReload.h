@@ -0,0 +1,412 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "Shader.h"
+
+// Watches shader source files and recompiles the shaders that use them on a background thread.
+// Compilation never touches the device; applyPendingReloads() creates the new objects and swaps
+// them in on the main thread, so call it between frames. A source that fails to compile is
+// reported and the old shader stays in use.
+class ShaderHotReload
+{
+public:
+	ShaderHotReload() = default;
+	ShaderHotReload(const ShaderHotReload&) = delete;
+	ShaderHotReload& operator=(const ShaderHotReload&) = delete;
+	~ShaderHotReload()
+	{
+		stop();
+	}
+
+	// Time to wait for more events after the first, editors often write a file in several steps
+	std::chrono::milliseconds settleTime{ 50 };
+	// How often file times are checked where inotify is not available
+	std::chrono::milliseconds pollInterval{ 250 };
+	unsigned long long reloadsApplied = 0;
+	unsigned long long reloadsFailed = 0;
+
+	void watch(Shader* shader, const std::string& vsFile, const std::string& psFile)
+	{
+		Target target;
+		target.shader = shader;
+		addTarget(target, vsFile, psFile);
+	}
+
+	// Only variants that have already been created are recompiled, the rest are dropped and
+	// compiled from the new source the next time they are requested
+	void watch(ShaderPermutations* permutations, const std::string& vsFile, const std::string& psFile)
+	{
+		Target target;
+		target.permutations = permutations;
+		addTarget(target, vsFile, psFile);
+	}
+
+	void start()
+	{
+		if (watcher.joinable())
+		{
+			return;
+		}
+		stopping = false;
+		watcher = std::thread([this]() { watchLoop(); });
+	}
+
+	void stop()
+	{
+		stopping = true;
+		if (watcher.joinable())
+		{
+			watcher.join();
+		}
+	}
+
+	// Swaps in everything that finished compiling since the last call. Main thread only.
+	void applyPendingReloads(Core* core)
+	{
+		std::vector<Result> results;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			results.swap(ready);
+		}
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			apply(core, results[i]);
+		}
+		// Give the watcher the variants that exist now
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < targets.size(); i++)
+		{
+			if (targets[i].permutations)
+			{
+				targets[i].keys.clear();
+				for (auto it = targets[i].permutations->variants.begin(); it != targets[i].permutations->variants.end(); ++it)
+				{
+					targets[i].keys.push_back(it->first);
+				}
+			}
+		}
+	}
+
+private:
+	struct Target
+	{
+		Shader* shader = nullptr;
+		ShaderPermutations* permutations = nullptr;
+		std::string vsFile;
+		std::string psFile;
+		std::string vsEntryPoint;
+		std::string psEntryPoint;
+		ShaderCache* cache = nullptr;
+		ShaderDefines defines;
+		std::vector<ShaderPermutationKey> keys;
+	};
+
+	struct Variant
+	{
+		ShaderPermutationKey key = 0;
+		ShaderCacheEntry vs;
+		ShaderCacheEntry ps;
+	};
+
+	struct Result
+	{
+		size_t target = 0;
+		std::string vsCode;
+		std::string psCode;
+		std::vector<Variant> variants;
+		std::string error;
+	};
+
+	std::vector<Target> targets;
+	std::vector<Result> ready;
+	std::map<std::string, std::filesystem::file_time_type> writeTimes;
+	std::mutex mutex;
+	std::thread watcher;
+	std::atomic<bool> stopping{ false };
+
+	static std::string normalise(const std::string& filename)
+	{
+		return std::filesystem::absolute(filename).lexically_normal().string();
+	}
+
+	void addTarget(Target& target, const std::string& vsFile, const std::string& psFile)
+	{
+		target.vsFile = normalise(vsFile);
+		target.psFile = normalise(psFile);
+		if (target.shader)
+		{
+			target.cache = target.shader->cache;
+			target.defines = target.shader->defines;
+			target.vsEntryPoint = target.shader->vsEntryPoint;
+			target.psEntryPoint = target.shader->psEntryPoint;
+		} else
+		{
+			target.cache = target.permutations->cache;
+			target.vsEntryPoint = target.permutations->vsEntryPoint;
+			target.psEntryPoint = target.permutations->psEntryPoint;
+			for (auto it = target.permutations->variants.begin(); it != target.permutations->variants.end(); ++it)
+			{
+				target.keys.push_back(it->first);
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		std::error_code ec;
+		writeTimes[target.vsFile] = std::filesystem::last_write_time(target.vsFile, ec);
+		writeTimes[target.psFile] = std::filesystem::last_write_time(target.psFile, ec);
+		targets.push_back(target);
+	}
+
+	static std::string readFile(const std::string& filename)
+	{
+		std::ifstream file(filename);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open shader file: " + filename);
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		return buffer.str();
+	}
+
+	static void compile(const Target& target, const std::string& code, const std::string& entryPoint, const std::string& profile, const ShaderDefines& defines, ShaderCacheEntry& entry)
+	{
+		if (target.cache)
+		{
+			target.cache->getOrCompile(code, entryPoint, profile, defines, &Shader::compileD3D, entry);
+		} else
+		{
+			Shader::compileD3D(code, entryPoint, profile, defines, entry);
+		}
+	}
+
+	// Runs on the watcher thread
+	void recompile(const std::set<std::string>& changed)
+	{
+		std::vector<Target> affected;
+		std::vector<size_t> indices;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < targets.size(); i++)
+			{
+				if (changed.count(targets[i].vsFile) || changed.count(targets[i].psFile))
+				{
+					affected.push_back(targets[i]);
+					indices.push_back(i);
+				}
+			}
+		}
+		for (size_t i = 0; i < affected.size(); i++)
+		{
+			const Target& target = affected[i];
+			Result result;
+			result.target = indices[i];
+			try
+			{
+				result.vsCode = readFile(target.vsFile);
+				result.psCode = readFile(target.psFile);
+				if (target.shader)
+				{
+					Variant variant;
+					compile(target, result.vsCode, target.vsEntryPoint, "vs_5_0", target.defines, variant.vs);
+					compile(target, result.psCode, target.psEntryPoint, "ps_5_0", target.defines, variant.ps);
+					result.variants.push_back(variant);
+				} else
+				{
+					for (size_t k = 0; k < target.keys.size(); k++)
+					{
+						Variant variant;
+						variant.key = target.keys[k];
+						ShaderDefines defines = target.permutations->definesFor(variant.key);
+						compile(target, result.vsCode, target.vsEntryPoint, "vs_5_0", defines, variant.vs);
+						compile(target, result.psCode, target.psEntryPoint, "ps_5_0", defines, variant.ps);
+						result.variants.push_back(variant);
+					}
+				}
+			} catch (const std::exception& e)
+			{
+				result.variants.clear();
+				result.error = e.what();
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.push_back(result);
+		}
+	}
+
+	void apply(Core* core, const Result& result)
+	{
+		Target& target = targets[result.target];
+		if (!result.error.empty())
+		{
+			std::cout << "Shader reload failed (" << target.vsFile << ", " << target.psFile << "): " << result.error << std::endl;
+			reloadsFailed++;
+			return;
+		}
+		try
+		{
+			if (target.shader)
+			{
+				target.shader->reload(core, result.variants[0].vs, result.variants[0].ps);
+			} else
+			{
+				ShaderPermutations* permutations = target.permutations;
+				std::set<ShaderPermutationKey> rebuilt;
+				for (size_t i = 0; i < result.variants.size(); i++)
+				{
+					auto it = permutations->variants.find(result.variants[i].key);
+					if (it != permutations->variants.end())
+					{
+						it->second.reload(core, result.variants[i].vs, result.variants[i].ps);
+						rebuilt.insert(it->first);
+					}
+				}
+				// Variants created or precompiled from the old source since the last snapshot
+				for (auto it = permutations->variants.begin(); it != permutations->variants.end();)
+				{
+					if (rebuilt.count(it->first) == 0)
+					{
+						it->second.release();
+						it = permutations->variants.erase(it);
+					} else
+					{
+						++it;
+					}
+				}
+				// Precompiles of the old source are dropped without waiting. Futures from the thread
+				// pool do not block when destroyed, the jobs finish and their results are discarded.
+				permutations->pending.clear();
+				permutations->vsCode = result.vsCode;
+				permutations->psCode = result.psCode;
+			}
+			reloadsApplied++;
+		} catch (const std::exception& e)
+		{
+			std::cout << "Shader reload failed (" << target.vsFile << ", " << target.psFile << "): " << e.what() << std::endl;
+			reloadsFailed++;
+		}
+	}
+
+	std::vector<std::string> watchedFiles()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<std::string> files;
+		for (auto it = writeTimes.begin(); it != writeTimes.end(); ++it)
+		{
+			files.push_back(it->first);
+		}
+		return files;
+	}
+
+#ifdef __linux__
+	// Watches the directories rather than the files, editors often save by writing a new file
+	// and renaming it over the old one, which would drop a watch on the file itself
+	void watchLoop()
+	{
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0)
+		{
+			pollLoop();
+			return;
+		}
+		std::map<int, std::string> directories;
+		std::set<std::string> watchedDirectories;
+		std::vector<std::string> files;
+		char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		while (!stopping)
+		{
+			// Files can be added with watch() after start()
+			files = watchedFiles();
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				std::string directory = std::filesystem::path(files[i]).parent_path().string();
+				if (watchedDirectories.insert(directory).second)
+				{
+					int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+					if (wd >= 0)
+					{
+						directories[wd] = directory;
+					}
+				}
+			}
+			pollfd pfd = { fd, POLLIN, 0 };
+			if (poll(&pfd, 1, static_cast<int>(pollInterval.count())) <= 0)
+			{
+				continue;
+			}
+			std::set<std::string> changed;
+			bool more = true;
+			while (more)
+			{
+				ssize_t length;
+				while ((length = read(fd, events, sizeof(events))) > 0)
+				{
+					for (char* p = events; p < events + length;)
+					{
+						const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+						auto dir = directories.find(event->wd);
+						if (dir != directories.end() && event->len > 0)
+						{
+							changed.insert((std::filesystem::path(dir->second) / event->name).lexically_normal().string());
+						}
+						p += sizeof(inotify_event) + event->len;
+					}
+				}
+				more = poll(&pfd, 1, static_cast<int>(settleTime.count())) > 0;
+			}
+			if (!changed.empty())
+			{
+				recompile(changed);
+			}
+		}
+		close(fd);
+	}
+#else
+	void watchLoop()
+	{
+		pollLoop();
+	}
+#endif
+
+	void pollLoop()
+	{
+		while (!stopping)
+		{
+			std::this_thread::sleep_for(pollInterval);
+			std::set<std::string> changed;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto it = writeTimes.begin(); it != writeTimes.end(); ++it)
+				{
+					std::error_code ec;
+					std::filesystem::file_time_type time = std::filesystem::last_write_time(it->first, ec);
+					if (!ec && time != it->second)
+					{
+						it->second = time;
+						changed.insert(it->first);
+					}
+				}
+			}
+			if (!changed.empty())
+			{
+				std::this_thread::sleep_for(settleTime);
+				recompile(changed);
+			}
+		}
+	}
+};
@@ -8,8 +8,15 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
 
 #include "Core.h" // Replace with your DXCore etc
+#include "ConstantBufferParser.h"
+#include "ConstantBufferShadow.h"
+#include "ConstantBufferLayout.h"
 
 #pragma comment(lib, "dxguid.lib")
 
@@ -19,80 +26,244 @@ enum ShaderStage
 	PixelShader
 };
 
-struct ConstantBufferVariable
+// A range of one constant buffer ring page, see ConstantBufferRing
+struct ConstantBufferSlice
 {
-	unsigned int offset;
-	unsigned int size;
+	ID3D11Buffer* buffer = nullptr;
+	unsigned int offset = 0;
+	unsigned int size = 0;
+	unsigned char* data = nullptr;
 };
 
-class ConstantBuffer
+class ConstantBuffer : public ConstantBufferShadow
 {
 public:
-	std::string name;
-	std::map<std::string, ConstantBufferVariable> constantBufferData;
 	ID3D11Buffer* cb;
-	unsigned char* buffer;
-	unsigned int cbSizeInBytes;
-	int dirty;
 	int index;
 	ShaderStage shaderStage;
+	// Partial uploads need UpdateSubresource1 on a default usage buffer (D3D11.1)
+	bool partialUpload;
+	// One bit per ShaderStage that binds this buffer
+	unsigned int stageMask;
+	// Where the data was last written when a ConstantBufferRing is in use, and in which frame
+	ConstantBufferSlice ringSlice;
+	unsigned long long ringFrame = 0;
 	void init(Core* core, unsigned int sizeInBytes, int constantBufferIndex, ShaderStage stage)
 	{
 		unsigned int sizeInBytes16 = ((sizeInBytes + 15) & -16);
+		partialUpload = core->deviceContext1 != nullptr && core->supportsConstantBufferPartialUpdate;
 		D3D11_BUFFER_DESC bd;
-		bd.Usage = D3D11_USAGE_DYNAMIC;
-		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (partialUpload)
+		{
+			bd.Usage = D3D11_USAGE_DEFAULT;
+			bd.CPUAccessFlags = 0;
+		} else
+		{
+			bd.Usage = D3D11_USAGE_DYNAMIC;
+			bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		}
 		bd.MiscFlags = 0;
-		D3D11_SUBRESOURCE_DATA data;
+		bd.StructureByteStride = 0;
 		bd.ByteWidth = sizeInBytes16;
 		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
 		core->device->CreateBuffer(&bd, NULL, &cb);
-		buffer = new unsigned char[sizeInBytes16];
-		cbSizeInBytes = sizeInBytes;
+		allocate(sizeInBytes);
 		index = constantBufferIndex;
-		dirty = 1;
 		shaderStage = stage;
+		stageMask = 1u << stage;
 	}
-	void update(std::string name, void* data)
+	void upload(Core* core)
 	{
-		ConstantBufferVariable cbVariable = constantBufferData[name];
-		memcpy(&buffer[cbVariable.offset], data, cbVariable.size);
-		dirty = 1;
+		commit(core);
+		// Always go through the state cache, another shader may have taken the slot since
+		core->setConstantBuffer(shaderStage, index, cb);
 	}
-	void upload(Core* core)
+	// Sends any changed data to the GPU without binding
+	void commit(Core* core)
+	{
+		if (partialUpload)
+		{
+			// Copy each run of consecutive dirty registers with its own box
+			flush(true, [this, core](unsigned int offset, unsigned int size)
+			{
+				D3D11_BOX box;
+				box.left = offset;
+				box.right = offset + size;
+				box.top = 0;
+				box.bottom = 1;
+				box.front = 0;
+				box.back = 1;
+				core->deviceContext1->UpdateSubresource1(cb, 0, &box, &buffer[offset], 0, 0, 0);
+			});
+		} else
+		{
+			flush(false, [this, core](unsigned int offset, unsigned int size)
+			{
+				D3D11_MAPPED_SUBRESOURCE mapped;
+				if (FAILED(core->deviceContext->Map(cb, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+				{
+					throw std::runtime_error("Failed to map constant buffer " + name + ".");
+				}
+				memcpy(mapped.pData, &buffer[offset], size);
+				core->deviceContext->Unmap(cb, 0);
+			});
+		}
+	}
+	void free()
+	{
+		cb->Release();
+	}
+};
+
+// A shared buffer as seen by one shader stage
+struct ConstantBufferBinding
+{
+	ConstantBuffer* buffer;
+	int slot;
+	ShaderStage stage;
+};
+
+// Owns one ConstantBuffer per name and layout, however many shaders and stages declare it.
+// The shadow copy is written and uploaded once, then bound wherever it is used.
+class ConstantBufferRegistry
+{
+public:
+	std::map<std::pair<std::string, unsigned int>, ConstantBuffer> buffers;
+	unsigned long long sharedHits = 0;
+
+	// layout only needs name, variables and cbSizeInBytes filled in
+	ConstantBuffer* acquire(Core* core, const ConstantBuffer& layout, ShaderStage stage)
+	{
+		std::pair<std::string, unsigned int> key(layout.name, layout.computeLayoutHash());
+		auto it = buffers.find(key);
+		if (it != buffers.end())
+		{
+			it->second.stageMask |= 1u << stage;
+			sharedHits++;
+			return &it->second;
+		}
+		ConstantBuffer& buffer = buffers[key];
+		buffer.name = layout.name;
+		buffer.constantBufferData = layout.constantBufferData;
+		buffer.constantBufferHashes = layout.constantBufferHashes;
+		buffer.init(core, layout.cbSizeInBytes, layout.index, stage);
+		return &buffer;
+	}
+	ConstantBuffer* find(const std::string& name)
+	{
+		for (auto it = buffers.begin(); it != buffers.end(); ++it)
+		{
+			if (it->first.first == name)
+			{
+				return &it->second;
+			}
+		}
+		return nullptr;
+	}
+	unsigned long long totalUploads() const
+	{
+		unsigned long long uploads = 0;
+		for (auto it = buffers.begin(); it != buffers.end(); ++it)
+		{
+			uploads += it->second.uploadCount;
+		}
+		return uploads;
+	}
+	void release()
+	{
+		for (auto it = buffers.begin(); it != buffers.end(); ++it)
+		{
+			it->second.free();
+		}
+		buffers.clear();
+	}
+};
+
+// A constant buffer whose contents are a whole C++ struct. update() writes the struct with a
+// single memcpy, no name lookups. attach() checks the struct against the reflected layout.
+template<typename T>
+class TypedConstantBuffer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Constant buffer structs must be trivially copyable");
+public:
+	ConstantBuffer* constantBuffer = nullptr;
+	ConstantBuffer ownedBuffer;
+
+	// Creates a buffer for the struct, for cbuffers that are not reflected from a shader
+	void init(Core* core, int constantBufferIndex, ShaderStage stage)
+	{
+		ownedBuffer.init(core, sizeof(T), constantBufferIndex, stage);
+		for (unsigned int i = 0; i < ConstantBufferLayout<T>::count; i++)
+		{
+			const ConstantBufferField& field = ConstantBufferLayout<T>::fields[i];
+			ownedBuffer.addVariable(field.name, field.offset, field.size);
+		}
+		constantBuffer = &ownedBuffer;
+	}
+	// Uses a buffer built by ConstantBufferReflection, throws if the layouts differ
+	void attach(ConstantBuffer& reflected)
 	{
-		if (dirty == 1)
+		if (reflected.cbSizeInBytes < sizeof(T))
 		{
-			D3D11_MAPPED_SUBRESOURCE mapped;
-			core->deviceContext->Map(cb, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-			memcpy(mapped.pData, buffer, cbSizeInBytes);
-			core->deviceContext->Unmap(cb, 0);
-			if (shaderStage == ShaderStage::VertexShader)
+			throw std::runtime_error("Constant buffer " + reflected.name + " is smaller than its C++ struct.");
+		}
+		for (unsigned int i = 0; i < ConstantBufferLayout<T>::count; i++)
+		{
+			const ConstantBufferField& field = ConstantBufferLayout<T>::fields[i];
+			auto it = reflected.constantBufferData.find(field.name);
+			if (it == reflected.constantBufferData.end())
 			{
-				core->deviceContext->VSSetConstantBuffers(index, 1, &cb);
+				throw std::runtime_error("Constant buffer " + reflected.name + " has no variable " + field.name + ".");
 			}
-			if (shaderStage == ShaderStage::PixelShader)
+			if (it->second.offset != field.offset || !matchesHLSLSize(field, it->second.size))
 			{
-				core->deviceContext->PSSetConstantBuffers(index, 1, &cb);
+				throw std::runtime_error("Constant buffer " + reflected.name + " variable " + field.name + " does not match its C++ layout.");
 			}
-			dirty = 0;
 		}
+		constantBuffer = &reflected;
+	}
+	void update(const T& data)
+	{
+		memcpy(constantBuffer->buffer, &data, sizeof(T));
+		constantBuffer->markDirty(0, sizeof(T));
+	}
+	void upload(Core* core)
+	{
+		constantBuffer->upload(core);
 	}
 	void free()
 	{
-		cb->Release();
+		if (constantBuffer == &ownedBuffer)
+		{
+			ownedBuffer.free();
+		}
 	}
 };
 
 class ConstantBufferReflection
 {
 public:
-	void build(Core* core, ID3DBlob* shader, std::vector<ConstantBuffer>& buffers, std::map<std::string, int>& textureBindPoints, ShaderStage stage)
+	// Fills in names, variables, sizes and bind slots without creating any GPU buffers
+	void reflect(ID3DBlob* shader, std::vector<ConstantBuffer>& layouts, std::map<std::string, int>& textureBindPoints)
 	{
 		ID3D11ShaderReflection* reflection;
 		D3DReflect(shader->GetBufferPointer(), shader->GetBufferSize(), IID_ID3D11ShaderReflection, (void**)&reflection);
 		D3D11_SHADER_DESC desc;
 		reflection->GetDesc(&desc);
+		std::map<std::string, int> constantBufferBindPoints;
+		for (int i = 0; i < desc.BoundResources; i++)
+		{
+			D3D11_SHADER_INPUT_BIND_DESC bindDesc;
+			reflection->GetResourceBindingDesc(i, &bindDesc);
+			if (bindDesc.Type == D3D_SIT_TEXTURE)
+			{
+				textureBindPoints.insert({ bindDesc.Name, bindDesc.BindPoint });
+			}
+			if (bindDesc.Type == D3D_SIT_CBUFFER)
+			{
+				constantBufferBindPoints.insert({ bindDesc.Name, bindDesc.BindPoint });
+			}
+		}
 		for (int i = 0; i < desc.ConstantBuffers; i++)
 		{
 			ConstantBuffer buffer;
@@ -100,29 +271,101 @@ public:
 			D3D11_SHADER_BUFFER_DESC cbDesc;
 			constantBuffer->GetDesc(&cbDesc);
 			buffer.name = cbDesc.Name;
-			unsigned int totalSize = 0;
 			for (int n = 0; n < cbDesc.Variables; n++)
 			{
 				ID3D11ShaderReflectionVariable* var = constantBuffer->GetVariableByIndex(n);
 				D3D11_SHADER_VARIABLE_DESC vDesc;
 				var->GetDesc(&vDesc);
-				ConstantBufferVariable bufferVariable;
-				bufferVariable.offset = vDesc.StartOffset;
-				bufferVariable.size = vDesc.Size;
-				buffer.constantBufferData.insert({ vDesc.Name, bufferVariable });
-				totalSize += bufferVariable.size;
+				buffer.addVariable(vDesc.Name, vDesc.StartOffset, vDesc.Size);
 			}
-			buffer.init(core, totalSize, i,stage);
+			// cbDesc.Size includes the packing padding between variables
+			buffer.cbSizeInBytes = cbDesc.Size;
+			// The register the shader reads from, which is not always the reflection index
+			auto bindPoint = constantBufferBindPoints.find(buffer.name);
+			buffer.index = bindPoint != constantBufferBindPoints.end() ? bindPoint->second : i;
+			layouts.push_back(buffer);
+		}
+		reflection->Release();
+	}
+	// Same as above but in the portable form that ShaderCache can store
+	void reflect(ID3DBlob* shader, std::vector<ParsedConstantBuffer>& parsed, std::map<std::string, int>& textureBindPoints)
+	{
+		std::vector<ConstantBuffer> layouts;
+		reflect(shader, layouts, textureBindPoints);
+		for (size_t i = 0; i < layouts.size(); i++)
+		{
+			ParsedConstantBuffer cb;
+			cb.name = layouts[i].name;
+			cb.registerIndex = layouts[i].index;
+			cb.size = layouts[i].cbSizeInBytes;
+			for (auto it = layouts[i].constantBufferData.begin(); it != layouts[i].constantBufferData.end(); ++it)
+			{
+				ParsedConstantBufferVariable var = {};
+				var.name = it->first;
+				var.offset = it->second.offset;
+				var.size = it->second.size;
+				cb.variables.push_back(var);
+			}
+			parsed.push_back(cb);
+		}
+	}
+	void build(Core* core, ID3DBlob* shader, std::vector<ConstantBuffer>& buffers, std::map<std::string, int>& textureBindPoints, ShaderStage stage)
+	{
+		std::vector<ConstantBuffer> layouts;
+		reflect(shader, layouts, textureBindPoints);
+		for (size_t i = 0; i < layouts.size(); i++)
+		{
+			layouts[i].init(core, layouts[i].cbSizeInBytes, layouts[i].index, stage);
+			buffers.push_back(layouts[i]);
+		}
+	}
+	// Shares buffers through the registry instead of creating one per shader and stage
+	void build(Core* core, ID3DBlob* shader, ConstantBufferRegistry& registry, std::vector<ConstantBufferBinding>& bindings, std::map<std::string, int>& textureBindPoints, ShaderStage stage)
+	{
+		std::vector<ConstantBuffer> layouts;
+		reflect(shader, layouts, textureBindPoints);
+		for (size_t i = 0; i < layouts.size(); i++)
+		{
+			ConstantBufferBinding binding;
+			binding.buffer = registry.acquire(core, layouts[i], stage);
+			binding.slot = layouts[i].index;
+			binding.stage = stage;
+			bindings.push_back(binding);
+		}
+	}
+	// Builds the same buffers from layouts parsed offline with ConstantBufferParser, no D3DReflect
+	void build(Core* core, const std::vector<ParsedConstantBuffer>& parsed, std::vector<ConstantBuffer>& buffers, ShaderStage stage)
+	{
+		for (size_t i = 0; i < parsed.size(); i++)
+		{
+			ConstantBuffer buffer;
+			buffer.name = parsed[i].name;
+			for (size_t n = 0; n < parsed[i].variables.size(); n++)
+			{
+				buffer.addVariable(parsed[i].variables[n].name, parsed[i].variables[n].offset, parsed[i].variables[n].size);
+			}
+			int slot = parsed[i].registerIndex >= 0 ? parsed[i].registerIndex : (int)i;
+			buffer.init(core, parsed[i].size, slot, stage);
 			buffers.push_back(buffer);
 		}
-		for (int i = 0; i < desc.BoundResources; i++)
+	}
+	void build(Core* core, const std::vector<ParsedConstantBuffer>& parsed, ConstantBufferRegistry& registry, std::vector<ConstantBufferBinding>& bindings, ShaderStage stage)
+	{
+		for (size_t i = 0; i < parsed.size(); i++)
 		{
-			D3D11_SHADER_INPUT_BIND_DESC bindDesc;
-			reflection->GetResourceBindingDesc(i, &bindDesc);
-			if (bindDesc.Type == D3D_SIT_TEXTURE)
+			ConstantBuffer layout;
+			layout.name = parsed[i].name;
+			for (size_t n = 0; n < parsed[i].variables.size(); n++)
 			{
-				textureBindPoints.insert({ bindDesc.Name, bindDesc.BindPoint });
+				layout.addVariable(parsed[i].variables[n].name, parsed[i].variables[n].offset, parsed[i].variables[n].size);
 			}
+			layout.cbSizeInBytes = parsed[i].size;
+			layout.index = parsed[i].registerIndex >= 0 ? parsed[i].registerIndex : (int)i;
+			ConstantBufferBinding binding;
+			binding.buffer = registry.acquire(core, layout, stage);
+			binding.slot = layout.index;
+			binding.stage = stage;
+			bindings.push_back(binding);
 		}
 	}
 };
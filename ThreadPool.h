@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+// Fixed set of worker threads fed from one queue. submit() returns a future for the result,
+// parallelFor() splits a range into chunks and waits for all of them.
+class ThreadPool
+{
+public:
+	ThreadPool() = default;
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool()
+	{
+		shutdown();
+	}
+
+	// threadCount 0 uses one thread per hardware thread
+	void init(unsigned int threadCount = 0)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+		stopping = false;
+		for (unsigned int i = 0; i < threadCount; i++)
+		{
+			workers.emplace_back([this]() { workerLoop(); });
+		}
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	template<typename F>
+	auto submit(F f) -> std::future<decltype(f())>
+	{
+		typedef decltype(f()) Result;
+		std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(f));
+		std::future<Result> future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back([task]() { (*task)(); });
+		}
+		wake.notify_one();
+		return future;
+	}
+
+	// Calls fn(begin, end) over [0, count) in chunks of at least minChunk items
+	void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t)>& fn)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		size_t chunks = std::max<size_t>(1, std::min<size_t>(workers.size() * 4, count / std::max<size_t>(1, minChunk)));
+		if (chunks == 1 || workers.empty())
+		{
+			fn(0, count);
+			return;
+		}
+		size_t chunkSize = (count + chunks - 1) / chunks;
+		std::vector<std::future<void>> pending;
+		for (size_t begin = chunkSize; begin < count; begin += chunkSize)
+		{
+			size_t end = (std::min)(count, begin + chunkSize);
+			pending.push_back(submit([&fn, begin, end]() { fn(begin, end); }));
+		}
+		// The calling thread takes the first chunk instead of idling. Queued chunks hold fn by
+		// reference, so every one is waited for before the first exception is rethrown.
+		std::exception_ptr error;
+		try
+		{
+			fn(0, (std::min)(count, chunkSize));
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			try
+			{
+				pending[i].get();
+			}
+			catch (...)
+			{
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+			}
+		}
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		workers.clear();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void workerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty())
+				{
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
@@ -0,0 +1,649 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "GEMLoader.h"
+#include "SIMDConfig.h"
+
+// Compressed vertex streams for GEM meshes:
+//   position - 16-bit UNORM relative to the mesh bounds, pos = offset + scale * p
+//   normal   - octahedral, two 16-bit SNORM
+//   tangent  - octahedral, two 16-bit SNORM
+//   uv       - two half floats
+//   bones    - 8-bit indices and 8-bit UNORM weights that still sum to exactly 1
+// CompressedStaticVertex is 20 bytes (GEMStaticVertex is 44), CompressedAnimatedVertex is
+// 28 bytes (GEMAnimatedVertex is 76).
+//
+// Decoding in HLSL, with offset and scale from CompressedMeshBounds in a constant buffer:
+//   float3 octDecode(float2 e)
+//   {
+//       float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+//       float t = saturate(-n.z);
+//       n.xy += (n.xy >= 0.0) ? -t : t;
+//       return normalize(n);
+//   }
+//   float3 position = offset.xyz + scale.xyz * input.Pos.xyz;
+
+struct PackedUnorm16x4
+{
+	unsigned short v[4];
+};
+
+struct PackedSnorm16x2
+{
+	short v[2];
+};
+
+struct PackedHalf2
+{
+	unsigned short v[2];
+};
+
+struct PackedUInt8x4
+{
+	unsigned char v[4];
+};
+
+struct PackedUnorm8x4
+{
+	unsigned char v[4];
+};
+
+struct CompressedStaticVertex
+{
+	PackedUnorm16x4 position;
+	PackedSnorm16x2 normal;
+	PackedSnorm16x2 tangent;
+	PackedHalf2 uv;
+};
+
+struct CompressedAnimatedVertex
+{
+	PackedUnorm16x4 position;
+	PackedSnorm16x2 normal;
+	PackedSnorm16x2 tangent;
+	PackedHalf2 uv;
+	PackedUInt8x4 bonesIDs;
+	PackedUnorm8x4 boneWeights;
+};
+
+static_assert(sizeof(CompressedStaticVertex) == 20, "CompressedStaticVertex must be tightly packed");
+static_assert(sizeof(CompressedAnimatedVertex) == 28, "CompressedAnimatedVertex must be tightly packed");
+
+// Laid out for a constant buffer, pos = offset + scale * quantised
+struct CompressedMeshBounds
+{
+	float offset[4];
+	float scale[4];
+};
+
+// Largest error of any decoded vertex. compress() returns bounds that hold for every vertex
+// of the input, measureError() returns what a round trip actually produced.
+struct VertexCompressionError
+{
+	float position = 0.0f;     // distance in model units
+	float normalAngle = 0.0f;  // radians
+	float tangentAngle = 0.0f; // radians
+	float uv = 0.0f;           // absolute, per component
+	float boneWeight = 0.0f;   // absolute, per weight
+};
+
+class VertexCompressor
+{
+public:
+	static CompressedMeshBounds computeBounds(const GEMLoader::GEMVec3* positions, size_t count, size_t stride)
+	{
+		CompressedMeshBounds bounds = {};
+		if (count == 0)
+		{
+			return bounds;
+		}
+		float lo[3] = { positions->x, positions->y, positions->z };
+		float hi[3] = { positions->x, positions->y, positions->z };
+		for (size_t i = 1; i < count; i++)
+		{
+			const GEMLoader::GEMVec3& p = *reinterpret_cast<const GEMLoader::GEMVec3*>(reinterpret_cast<const unsigned char*>(positions) + i * stride);
+			lo[0] = (std::min)(lo[0], p.x);
+			lo[1] = (std::min)(lo[1], p.y);
+			lo[2] = (std::min)(lo[2], p.z);
+			hi[0] = (std::max)(hi[0], p.x);
+			hi[1] = (std::max)(hi[1], p.y);
+			hi[2] = (std::max)(hi[2], p.z);
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			bounds.offset[k] = lo[k];
+			// A flat axis still needs a non-zero scale for the inverse
+			bounds.scale[k] = (std::max)(hi[k] - lo[k], 1e-20f);
+		}
+		bounds.offset[3] = 0.0f;
+		bounds.scale[3] = 1.0f;
+		return bounds;
+	}
+
+	// Worst-case error for data inside bounds with |uv| <= maxUV
+	static VertexCompressionError errorBounds(const CompressedMeshBounds& bounds, float maxUV)
+	{
+		VertexCompressionError error;
+		float step[3];
+		for (int k = 0; k < 3; k++)
+		{
+			// Half a quantisation step, plus float rounding in offset + scale * p
+			step[k] = bounds.scale[k] * (0.5f / 65535.0f) + (std::fabs(bounds.offset[k]) + bounds.scale[k]) * 1.2e-7f;
+		}
+		error.position = std::sqrt(step[0] * step[0] + step[1] * step[1] + step[2] * step[2]);
+		// Rounding moves each octahedral coordinate by at most half a step, which moves the
+		// unnormalised vector by at most sqrt(6) times that; normalising from a length of at
+		// least 1/sqrt(3) scales it by up to sqrt(3)
+		error.normalAngle = std::sqrt(18.0f) * (0.5f / 32767.0f) + 1e-6f;
+		error.tangentAngle = error.normalAngle;
+		// Half floats keep 11 significant bits; below 2^-14 the spacing is fixed at 2^-24
+		error.uv = (std::max)(maxUV * (1.0f / 2048.0f), 1.0f / 16777216.0f);
+		error.boneWeight = 1.0f / 255.0f;
+		return error;
+	}
+
+	VertexCompressionError compress(const std::vector<GEMLoader::GEMStaticVertex>& vertices, std::vector<CompressedStaticVertex>& output, CompressedMeshBounds& bounds)
+	{
+		bounds = computeBounds(&vertices.data()->position, vertices.size(), sizeof(GEMLoader::GEMStaticVertex));
+		output.resize(vertices.size());
+		encodeStreams(vertices.data(), output.data(), vertices.size(), bounds);
+		return errorBounds(bounds, maxAbsUV(vertices));
+	}
+
+	VertexCompressionError compress(const std::vector<GEMLoader::GEMAnimatedVertex>& vertices, std::vector<CompressedAnimatedVertex>& output, CompressedMeshBounds& bounds)
+	{
+		bounds = computeBounds(&vertices.data()->position, vertices.size(), sizeof(GEMLoader::GEMAnimatedVertex));
+		output.resize(vertices.size());
+		encodeStreams(vertices.data(), output.data(), vertices.size(), bounds);
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				if (vertices[i].bonesIDs[k] > 255)
+				{
+					throw std::runtime_error("Bone index does not fit in 8 bits for vertex compression.");
+				}
+				output[i].bonesIDs.v[k] = static_cast<unsigned char>(vertices[i].bonesIDs[k]);
+			}
+			quantizeWeights(vertices[i].boneWeights, output[i].boneWeights.v);
+		}
+		return errorBounds(bounds, maxAbsUV(vertices));
+	}
+
+	void decompress(const std::vector<CompressedStaticVertex>& vertices, const CompressedMeshBounds& bounds, std::vector<GEMLoader::GEMStaticVertex>& output)
+	{
+		output.resize(vertices.size());
+		decodeStreams(vertices.data(), output.data(), vertices.size(), bounds);
+	}
+
+	void decompress(const std::vector<CompressedAnimatedVertex>& vertices, const CompressedMeshBounds& bounds, std::vector<GEMLoader::GEMAnimatedVertex>& output)
+	{
+		output.resize(vertices.size());
+		decodeStreams(vertices.data(), output.data(), vertices.size(), bounds);
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				output[i].bonesIDs[k] = vertices[i].bonesIDs.v[k];
+				output[i].boneWeights[k] = vertices[i].boneWeights.v[k] / 255.0f;
+			}
+		}
+	}
+
+	template<typename Vertex>
+	static VertexCompressionError measureError(const std::vector<Vertex>& original, const std::vector<Vertex>& decoded)
+	{
+		VertexCompressionError error;
+		for (size_t i = 0; i < original.size() && i < decoded.size(); i++)
+		{
+			const Vertex& a = original[i];
+			const Vertex& b = decoded[i];
+			float dx = a.position.x - b.position.x;
+			float dy = a.position.y - b.position.y;
+			float dz = a.position.z - b.position.z;
+			error.position = (std::max)(error.position, std::sqrt(dx * dx + dy * dy + dz * dz));
+			error.normalAngle = (std::max)(error.normalAngle, angleBetween(a.normal, b.normal));
+			error.tangentAngle = (std::max)(error.tangentAngle, angleBetween(a.tangent, b.tangent));
+			error.uv = (std::max)(error.uv, (std::max)(std::fabs(a.u - b.u), std::fabs(a.v - b.v)));
+			measureWeightError(a, b, error);
+		}
+		return error;
+	}
+
+	// Scalar building blocks, also used for the tails of the SIMD loops
+
+	static unsigned short floatToHalf(float f)
+	{
+		unsigned int x;
+		memcpy(&x, &f, sizeof(float));
+		unsigned int sign = (x >> 16) & 0x8000;
+		unsigned int magnitude = x & 0x7FFFFFFF;
+		if (magnitude >= 0x7F800000)
+		{
+			// Inf stays Inf, NaN stays a quiet NaN
+			return static_cast<unsigned short>(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+		}
+		if (magnitude >= 0x477FF000)
+		{
+			// Rounds to more than the largest half
+			return static_cast<unsigned short>(sign | 0x7C00);
+		}
+		if (magnitude < 0x38800000)
+		{
+			// Subnormal half: shift the mantissa with its implicit bit, round to nearest even
+			if (magnitude < 0x33000000)
+			{
+				return static_cast<unsigned short>(sign);
+			}
+			unsigned int exponent = magnitude >> 23;
+			unsigned int mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+			unsigned int shift = 126 - exponent;
+			unsigned int half = mantissa >> shift;
+			unsigned int remainder = mantissa & ((1u << shift) - 1);
+			unsigned int midpoint = 1u << (shift - 1);
+			if (remainder > midpoint || (remainder == midpoint && (half & 1)))
+			{
+				half++;
+			}
+			return static_cast<unsigned short>(sign | half);
+		}
+		// Normal half: rebias the exponent and round the mantissa to nearest even
+		unsigned int half = (magnitude - 0x38000000) >> 13;
+		unsigned int remainder = magnitude & 0x1FFF;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		{
+			half++;
+		}
+		return static_cast<unsigned short>(sign | half);
+	}
+
+	static float halfToFloat(unsigned short h)
+	{
+		unsigned int sign = (h & 0x8000u) << 16;
+		unsigned int exponent = (h >> 10) & 0x1F;
+		unsigned int mantissa = h & 0x3FF;
+		unsigned int x;
+		if (exponent == 0)
+		{
+			if (mantissa == 0)
+			{
+				x = sign;
+			} else
+			{
+				// Subnormal half becomes a normal float
+				exponent = 113;
+				while ((mantissa & 0x400) == 0)
+				{
+					mantissa <<= 1;
+					exponent--;
+				}
+				x = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+			}
+		} else if (exponent == 31)
+		{
+			x = sign | 0x7F800000 | (mantissa << 13);
+		} else
+		{
+			x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		float f;
+		memcpy(&f, &x, sizeof(float));
+		return f;
+	}
+
+	static void octEncode(float x, float y, float z, short out[2])
+	{
+		float l1 = (std::max)(std::fabs(x) + std::fabs(y) + std::fabs(z), 1e-20f);
+		float ox = x / l1;
+		float oy = y / l1;
+		if (z < 0.0f)
+		{
+			// copysign like signOf in octEncode4, so -0.0 folds the same way on both paths
+			float fx = (1.0f - std::fabs(oy)) * std::copysign(1.0f, ox);
+			float fy = (1.0f - std::fabs(ox)) * std::copysign(1.0f, oy);
+			ox = fx;
+			oy = fy;
+		}
+		out[0] = static_cast<short>(static_cast<int>(std::nearbyint((std::min)((std::max)(ox, -1.0f), 1.0f) * 32767.0f)));
+		out[1] = static_cast<short>(static_cast<int>(std::nearbyint((std::min)((std::max)(oy, -1.0f), 1.0f) * 32767.0f)));
+	}
+
+	static void octDecode(const short in[2], float& x, float& y, float& z)
+	{
+		// Same operations as octDecode4 so both paths give identical results
+		x = (std::max)(in[0] * (1.0f / 32767.0f), -1.0f);
+		y = (std::max)(in[1] * (1.0f / 32767.0f), -1.0f);
+		z = 1.0f - std::fabs(x) - std::fabs(y);
+		float t = (std::max)(-z, 0.0f);
+		x -= t * std::copysign(1.0f, x);
+		y -= t * std::copysign(1.0f, y);
+		float length = std::sqrt(x * x + y * y + z * z);
+		x /= length;
+		y /= length;
+		z /= length;
+	}
+
+	// Rounds each weight to 1/255 so the bytes add up to exactly 255. The largest remainders
+	// round up, which keeps every weight within 1/255 of its normalised value.
+	static void quantizeWeights(const float weights[4], unsigned char out[4])
+	{
+		float sum = weights[0] + weights[1] + weights[2] + weights[3];
+		if (sum <= 0.0f)
+		{
+			out[0] = 255;
+			out[1] = out[2] = out[3] = 0;
+			return;
+		}
+		int total = 0;
+		float remainder[4];
+		int q[4];
+		for (int k = 0; k < 4; k++)
+		{
+			float scaled = (std::max)(weights[k], 0.0f) * 255.0f / sum;
+			q[k] = static_cast<int>(scaled);
+			remainder[k] = scaled - q[k];
+			total += q[k];
+		}
+		while (total < 255)
+		{
+			int best = 0;
+			for (int k = 1; k < 4; k++)
+			{
+				if (remainder[k] > remainder[best])
+				{
+					best = k;
+				}
+			}
+			q[best]++;
+			remainder[best] = -1.0f;
+			total++;
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			out[k] = static_cast<unsigned char>(q[k]);
+		}
+	}
+
+	// The scalar loops of compress() and decompress() over every vertex, with the bounds given
+	// and bone data left alone. For checking that the SIMD loops give bit-identical results.
+	template<typename Source, typename Target>
+	static void encodeScalar(const Source* vertices, Target* output, size_t count, const CompressedMeshBounds& bounds)
+	{
+		encodeStreams(vertices, output, count, bounds, false);
+	}
+
+	template<typename Source, typename Target>
+	static void decodeScalar(const Source* vertices, Target* output, size_t count, const CompressedMeshBounds& bounds)
+	{
+		decodeStreams(vertices, output, count, bounds, false);
+	}
+
+private:
+	template<typename Vertex>
+	static float maxAbsUV(const std::vector<Vertex>& vertices)
+	{
+		float m = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			m = (std::max)(m, (std::max)(std::fabs(vertices[i].u), std::fabs(vertices[i].v)));
+		}
+		return m;
+	}
+
+	static float angleBetween(const GEMLoader::GEMVec3& a, const GEMLoader::GEMVec3& b)
+	{
+		float la = std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+		float lb = std::sqrt(b.x * b.x + b.y * b.y + b.z * b.z);
+		if (la == 0.0f || lb == 0.0f)
+		{
+			return 0.0f;
+		}
+		// atan2 of cross and dot stays accurate for tiny angles, acos does not
+		float cx = a.y * b.z - a.z * b.y;
+		float cy = a.z * b.x - a.x * b.z;
+		float cz = a.x * b.y - a.y * b.x;
+		return std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), a.x * b.x + a.y * b.y + a.z * b.z);
+	}
+
+	static void measureWeightError(const GEMLoader::GEMStaticVertex&, const GEMLoader::GEMStaticVertex&, VertexCompressionError&)
+	{
+	}
+
+	static void measureWeightError(const GEMLoader::GEMAnimatedVertex& a, const GEMLoader::GEMAnimatedVertex& b, VertexCompressionError& error)
+	{
+		float sum = a.boneWeights[0] + a.boneWeights[1] + a.boneWeights[2] + a.boneWeights[3];
+		for (int k = 0; k < 4; k++)
+		{
+			float expected = sum > 0.0f ? a.boneWeights[k] / sum : (k == 0 ? 1.0f : 0.0f);
+			error.boneWeight = (std::max)(error.boneWeight, std::fabs(expected - b.boneWeights[k]));
+		}
+	}
+
+	// Position, normal, tangent and uv are at the same offsets in both GEM vertex types and
+	// both compressed types, so one pair of loops serves both
+	template<typename Source, typename Target>
+	static void encodeStreams(const Source* vertices, Target* output, size_t count, const CompressedMeshBounds& bounds, bool simd = true)
+	{
+		float inverse[3];
+		for (int k = 0; k < 3; k++)
+		{
+			inverse[k] = 65535.0f / bounds.scale[k];
+		}
+		size_t i = 0;
+#ifdef SIMD_SSE2
+		const __m128 offset = _mm_setr_ps(bounds.offset[0], bounds.offset[1], bounds.offset[2], 0.0f);
+		const __m128 scale = _mm_setr_ps(inverse[0], inverse[1], inverse[2], 0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 maxUnorm = _mm_set1_ps(65535.0f);
+		const __m128i bias32 = _mm_set1_epi32(32768);
+		const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+		for (; simd && i + 4 <= count; i += 4)
+		{
+			for (int n = 0; n < 4; n++)
+			{
+				const Source& v = vertices[i + n];
+				__m128 p = _mm_setr_ps(v.position.x, v.position.y, v.position.z, 0.0f);
+				p = _mm_mul_ps(_mm_sub_ps(p, offset), scale);
+				p = _mm_min_ps(_mm_max_ps(p, zero), maxUnorm);
+				// SSE2 only packs signed 16-bit, so shift into signed range and back
+				__m128i q = _mm_sub_epi32(_mm_cvtps_epi32(p), bias32);
+				q = _mm_xor_si128(_mm_packs_epi32(q, q), bias16);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(output[i + n].position.v), q);
+			}
+			short normals[8];
+			short tangents[8];
+			octEncode4(_mm_setr_ps(vertices[i].normal.x, vertices[i + 1].normal.x, vertices[i + 2].normal.x, vertices[i + 3].normal.x),
+				_mm_setr_ps(vertices[i].normal.y, vertices[i + 1].normal.y, vertices[i + 2].normal.y, vertices[i + 3].normal.y),
+				_mm_setr_ps(vertices[i].normal.z, vertices[i + 1].normal.z, vertices[i + 2].normal.z, vertices[i + 3].normal.z), normals);
+			octEncode4(_mm_setr_ps(vertices[i].tangent.x, vertices[i + 1].tangent.x, vertices[i + 2].tangent.x, vertices[i + 3].tangent.x),
+				_mm_setr_ps(vertices[i].tangent.y, vertices[i + 1].tangent.y, vertices[i + 2].tangent.y, vertices[i + 3].tangent.y),
+				_mm_setr_ps(vertices[i].tangent.z, vertices[i + 1].tangent.z, vertices[i + 2].tangent.z, vertices[i + 3].tangent.z), tangents);
+			unsigned short uvs[8];
+			halfEncode8(_mm_setr_ps(vertices[i].u, vertices[i].v, vertices[i + 1].u, vertices[i + 1].v),
+				_mm_setr_ps(vertices[i + 2].u, vertices[i + 2].v, vertices[i + 3].u, vertices[i + 3].v), uvs);
+			for (int n = 0; n < 4; n++)
+			{
+				output[i + n].position.v[3] = 0;
+				output[i + n].normal.v[0] = normals[n];
+				output[i + n].normal.v[1] = normals[n + 4];
+				output[i + n].tangent.v[0] = tangents[n];
+				output[i + n].tangent.v[1] = tangents[n + 4];
+				output[i + n].uv.v[0] = uvs[n * 2];
+				output[i + n].uv.v[1] = uvs[n * 2 + 1];
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			const Source& v = vertices[i];
+			const float p[3] = { v.position.x, v.position.y, v.position.z };
+			for (int k = 0; k < 3; k++)
+			{
+				float q = (std::min)((std::max)((p[k] - bounds.offset[k]) * inverse[k], 0.0f), 65535.0f);
+				output[i].position.v[k] = static_cast<unsigned short>(static_cast<int>(std::nearbyint(q)));
+			}
+			output[i].position.v[3] = 0;
+			octEncode(v.normal.x, v.normal.y, v.normal.z, output[i].normal.v);
+			octEncode(v.tangent.x, v.tangent.y, v.tangent.z, output[i].tangent.v);
+			output[i].uv.v[0] = floatToHalf(v.u);
+			output[i].uv.v[1] = floatToHalf(v.v);
+		}
+	}
+
+	template<typename Source, typename Target>
+	static void decodeStreams(const Source* vertices, Target* output, size_t count, const CompressedMeshBounds& bounds, bool simd = true)
+	{
+		float scale[3];
+		for (int k = 0; k < 3; k++)
+		{
+			scale[k] = bounds.scale[k] / 65535.0f;
+		}
+		size_t i = 0;
+#ifdef SIMD_SSE2
+		const __m128 offset = _mm_setr_ps(bounds.offset[0], bounds.offset[1], bounds.offset[2], 0.0f);
+		const __m128 step = _mm_setr_ps(scale[0], scale[1], scale[2], 0.0f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; simd && i + 4 <= count; i += 4)
+		{
+			for (int n = 0; n < 4; n++)
+			{
+				__m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(vertices[i + n].position.v));
+				__m128 p = _mm_add_ps(offset, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q, zero)), step));
+				float decoded[4];
+				_mm_storeu_ps(decoded, p);
+				output[i + n].position.x = decoded[0];
+				output[i + n].position.y = decoded[1];
+				output[i + n].position.z = decoded[2];
+			}
+			float x[4];
+			float y[4];
+			float z[4];
+			octDecode4(vertices + i, &Source::normal, x, y, z);
+			for (int n = 0; n < 4; n++)
+			{
+				output[i + n].normal.x = x[n];
+				output[i + n].normal.y = y[n];
+				output[i + n].normal.z = z[n];
+			}
+			octDecode4(vertices + i, &Source::tangent, x, y, z);
+			for (int n = 0; n < 4; n++)
+			{
+				output[i + n].tangent.x = x[n];
+				output[i + n].tangent.y = y[n];
+				output[i + n].tangent.z = z[n];
+			}
+			unsigned short uvs[8];
+			for (int n = 0; n < 4; n++)
+			{
+				uvs[n * 2] = vertices[i + n].uv.v[0];
+				uvs[n * 2 + 1] = vertices[i + n].uv.v[1];
+			}
+			float decodedUV[8];
+			halfDecode8(uvs, decodedUV);
+			for (int n = 0; n < 4; n++)
+			{
+				output[i + n].u = decodedUV[n * 2];
+				output[i + n].v = decodedUV[n * 2 + 1];
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			const Source& v = vertices[i];
+			output[i].position.x = bounds.offset[0] + v.position.v[0] * scale[0];
+			output[i].position.y = bounds.offset[1] + v.position.v[1] * scale[1];
+			output[i].position.z = bounds.offset[2] + v.position.v[2] * scale[2];
+			octDecode(v.normal.v, output[i].normal.x, output[i].normal.y, output[i].normal.z);
+			octDecode(v.tangent.v, output[i].tangent.x, output[i].tangent.y, output[i].tangent.z);
+			output[i].u = halfToFloat(v.uv.v[0]);
+			output[i].v = halfToFloat(v.uv.v[1]);
+		}
+	}
+
+#ifdef SIMD_SSE2
+	static __m128 signOf(__m128 v)
+	{
+		// +1 or -1 with the sign of v
+		return _mm_or_ps(_mm_and_ps(v, _mm_set1_ps(-0.0f)), _mm_set1_ps(1.0f));
+	}
+
+	static __m128 absOf(__m128 v)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+	}
+
+	// Octahedral encoding of four vectors; out gets four x values followed by four y values
+	static void octEncode4(__m128 x, __m128 y, __m128 z, short out[8])
+	{
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 l1 = _mm_max_ps(_mm_add_ps(_mm_add_ps(absOf(x), absOf(y)), absOf(z)), _mm_set1_ps(1e-20f));
+		__m128 ox = _mm_div_ps(x, l1);
+		__m128 oy = _mm_div_ps(y, l1);
+		__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(one, absOf(oy)), signOf(ox));
+		__m128 fy = _mm_mul_ps(_mm_sub_ps(one, absOf(ox)), signOf(oy));
+		ox = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, ox));
+		oy = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, oy));
+		__m128 limit = _mm_set1_ps(32767.0f);
+		__m128 sx = _mm_min_ps(_mm_max_ps(_mm_mul_ps(ox, limit), _mm_set1_ps(-32767.0f)), limit);
+		__m128 sy = _mm_min_ps(_mm_max_ps(_mm_mul_ps(oy, limit), _mm_set1_ps(-32767.0f)), limit);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(sx), _mm_cvtps_epi32(sy));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+	}
+
+	template<typename Source>
+	static void octDecode4(const Source* vertices, PackedSnorm16x2 Source::* field, float x[4], float y[4], float z[4])
+	{
+		__m128 inverse = _mm_set1_ps(1.0f / 32767.0f);
+		__m128 minusOne = _mm_set1_ps(-1.0f);
+		__m128 ex = _mm_setr_ps((vertices[0].*field).v[0], (vertices[1].*field).v[0], (vertices[2].*field).v[0], (vertices[3].*field).v[0]);
+		__m128 ey = _mm_setr_ps((vertices[0].*field).v[1], (vertices[1].*field).v[1], (vertices[2].*field).v[1], (vertices[3].*field).v[1]);
+		__m128 nx = _mm_max_ps(_mm_mul_ps(ex, inverse), minusOne);
+		__m128 ny = _mm_max_ps(_mm_mul_ps(ey, inverse), minusOne);
+		__m128 nz = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), absOf(nx)), absOf(ny));
+		__m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), nz), _mm_setzero_ps());
+		// x += x >= 0 ? -t : t, i.e. subtract t with the sign of x
+		nx = _mm_sub_ps(nx, _mm_mul_ps(t, signOf(nx)));
+		ny = _mm_sub_ps(ny, _mm_mul_ps(t, signOf(ny)));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+		_mm_storeu_ps(x, _mm_div_ps(nx, length));
+		_mm_storeu_ps(y, _mm_div_ps(ny, length));
+		_mm_storeu_ps(z, _mm_div_ps(nz, length));
+	}
+
+	static void halfEncode8(__m128 a, __m128 b, unsigned short out[8])
+	{
+#ifdef SIMD_F16C
+		__m128i packed = _mm_unpacklo_epi64(_mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT), _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+#else
+		float values[8];
+		_mm_storeu_ps(values, a);
+		_mm_storeu_ps(values + 4, b);
+		for (int k = 0; k < 8; k++)
+		{
+			out[k] = floatToHalf(values[k]);
+		}
+#endif
+	}
+
+	static void halfDecode8(const unsigned short in[8], float out[8])
+	{
+#ifdef SIMD_F16C
+		__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+		_mm_storeu_ps(out, _mm_cvtph_ps(packed));
+		_mm_storeu_ps(out + 4, _mm_cvtph_ps(_mm_unpackhi_epi64(packed, packed)));
+#else
+		for (int k = 0; k < 8; k++)
+		{
+			out[k] = halfToFloat(in[k]);
+		}
+#endif
+	}
+#endif
+};
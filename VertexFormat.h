@@ -0,0 +1,263 @@
+#pragma once
+
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <d3d11shader.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <cstddef>
+
+// DXGI format for a vertex field type. Specialise it for vector and colour classes next to
+// the class, e.g. template<> struct VertexElementFormat<Vec3> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32_FLOAT, 12> {};
+template<typename T>
+struct VertexElementFormat;
+
+template<DXGI_FORMAT Format, unsigned int Size>
+struct VertexElementFormatOf
+{
+	static constexpr DXGI_FORMAT format = Format;
+	static constexpr unsigned int size = Size;
+};
+
+template<> struct VertexElementFormat<float> : VertexElementFormatOf<DXGI_FORMAT_R32_FLOAT, 4> {};
+template<> struct VertexElementFormat<float[2]> : VertexElementFormatOf<DXGI_FORMAT_R32G32_FLOAT, 8> {};
+template<> struct VertexElementFormat<float[3]> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32_FLOAT, 12> {};
+template<> struct VertexElementFormat<float[4]> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32A32_FLOAT, 16> {};
+template<> struct VertexElementFormat<unsigned int> : VertexElementFormatOf<DXGI_FORMAT_R32_UINT, 4> {};
+template<> struct VertexElementFormat<unsigned int[2]> : VertexElementFormatOf<DXGI_FORMAT_R32G32_UINT, 8> {};
+template<> struct VertexElementFormat<unsigned int[3]> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32_UINT, 12> {};
+template<> struct VertexElementFormat<unsigned int[4]> : VertexElementFormatOf<DXGI_FORMAT_R32G32B32A32_UINT, 16> {};
+
+struct VertexElement
+{
+	const char* semantic;
+	unsigned int semanticIndex;
+	DXGI_FORMAT format;
+	unsigned int offset;
+};
+
+template<typename Field>
+constexpr VertexElement makeVertexElement(const char* semantic, unsigned int semanticIndex, unsigned int offset)
+{
+	static_assert(sizeof(Field) == VertexElementFormat<Field>::size, "Vertex field size does not match its DXGI format");
+	return VertexElement{ semantic, semanticIndex, VertexElementFormat<Field>::format, offset };
+}
+
+// Specialised by VERTEX_FORMAT for each vertex struct
+template<typename T>
+struct VertexFormat;
+
+#define VERTEX_ELEMENT(Type, field, semantic, semanticIndex) makeVertexElement<decltype(Type::field)>(semantic, semanticIndex, static_cast<unsigned int>(offsetof(Type, field)))
+
+// For an element spread over adjacent fields, e.g. separate u and v read as one float2
+#define VERTEX_ELEMENT_AS(Type, field, AsType, semantic, semanticIndex) makeVertexElement<AsType>(semantic, semanticIndex, static_cast<unsigned int>(offsetof(Type, field)))
+
+// Describes a vertex struct for input layout creation:
+// VERTEX_FORMAT(Vertex, VERTEX_ELEMENT(Vertex, position, "POS", 0), VERTEX_ELEMENT(Vertex, colour, "COLOUR", 0));
+#define VERTEX_FORMAT(Type, ...) \
+	template<> struct VertexFormat<Type> \
+	{ \
+		static constexpr VertexElement elements[] = { __VA_ARGS__ }; \
+		static constexpr unsigned int count = sizeof(elements) / sizeof(elements[0]); \
+		static constexpr unsigned int stride = sizeof(Type); \
+	}
+
+// Appends the elements of T read from one vertex buffer slot
+template<typename T>
+void appendInputElements(std::vector<D3D11_INPUT_ELEMENT_DESC>& desc, unsigned int slot = 0, D3D11_INPUT_CLASSIFICATION classification = D3D11_INPUT_PER_VERTEX_DATA, unsigned int stepRate = 0)
+{
+	for (unsigned int i = 0; i < VertexFormat<T>::count; i++)
+	{
+		const VertexElement& element = VertexFormat<T>::elements[i];
+		desc.push_back({ element.semantic, element.semanticIndex, element.format, slot, element.offset, classification, stepRate });
+	}
+}
+
+// Creates each distinct input layout once. Layouts are found by a hash of the element
+// descriptions and a hash of the vertex shader's input signature, then compared in full
+// (semantic names included), so shaders that read the same vertex format share one
+// ID3D11InputLayout and a hash collision can never hand out the wrong one.
+class InputLayoutCache
+{
+public:
+	// One input element with its own copy of the semantic name
+	struct ElementKey
+	{
+		std::string semantic;
+		unsigned int semanticIndex;
+		unsigned int format;
+		unsigned int inputSlot;
+		unsigned int offset;
+		unsigned int inputSlotClass;
+		unsigned int stepRate;
+		bool operator==(const ElementKey& other) const
+		{
+			return semantic == other.semantic && semanticIndex == other.semanticIndex && format == other.format && inputSlot == other.inputSlot &&
+				offset == other.offset && inputSlotClass == other.inputSlotClass && stepRate == other.stepRate;
+		}
+	};
+
+	// One parameter of a vertex shader's input signature
+	struct SignatureParameter
+	{
+		std::string semantic;
+		unsigned int semanticIndex;
+		unsigned int reg;
+		unsigned int componentType;
+		unsigned int mask;
+		bool operator==(const SignatureParameter& other) const
+		{
+			return semantic == other.semantic && semanticIndex == other.semanticIndex && reg == other.reg &&
+				componentType == other.componentType && mask == other.mask;
+		}
+	};
+
+	struct Entry
+	{
+		std::vector<ElementKey> elements;
+		std::vector<SignatureParameter> signature;
+		ID3D11InputLayout* layout;
+	};
+
+	std::map<std::pair<unsigned int, unsigned int>, std::vector<Entry>> layouts;
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+
+	static std::vector<ElementKey> readElements(const D3D11_INPUT_ELEMENT_DESC* desc, unsigned int count)
+	{
+		std::vector<ElementKey> elements(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			elements[i].semantic = desc[i].SemanticName;
+			elements[i].semanticIndex = desc[i].SemanticIndex;
+			elements[i].format = static_cast<unsigned int>(desc[i].Format);
+			elements[i].inputSlot = desc[i].InputSlot;
+			elements[i].offset = desc[i].AlignedByteOffset;
+			elements[i].inputSlotClass = static_cast<unsigned int>(desc[i].InputSlotClass);
+			elements[i].stepRate = desc[i].InstanceDataStepRate;
+		}
+		return elements;
+	}
+
+	static std::vector<SignatureParameter> readInputSignature(const void* bytecode, size_t size)
+	{
+		ID3D11ShaderReflection* reflection = nullptr;
+		if (FAILED(D3DReflect(bytecode, size, IID_ID3D11ShaderReflection, (void**)&reflection)))
+		{
+			throw std::runtime_error("Failed to reflect vertex shader input signature.");
+		}
+		D3D11_SHADER_DESC desc;
+		reflection->GetDesc(&desc);
+		std::vector<SignatureParameter> signature(desc.InputParameters);
+		for (unsigned int i = 0; i < desc.InputParameters; i++)
+		{
+			D3D11_SIGNATURE_PARAMETER_DESC parameter;
+			reflection->GetInputParameterDesc(i, &parameter);
+			signature[i].semantic = parameter.SemanticName;
+			signature[i].semanticIndex = parameter.SemanticIndex;
+			signature[i].reg = parameter.Register;
+			signature[i].componentType = static_cast<unsigned int>(parameter.ComponentType);
+			signature[i].mask = static_cast<unsigned int>(parameter.Mask);
+		}
+		reflection->Release();
+		return signature;
+	}
+
+	static unsigned int hashElements(const std::vector<ElementKey>& elements)
+	{
+		unsigned int hash = 2166136261u;
+		for (size_t i = 0; i < elements.size(); i++)
+		{
+			hash = hashString(elements[i].semantic.c_str(), hash);
+			hash = hashValue(elements[i].semanticIndex, hash);
+			hash = hashValue(elements[i].format, hash);
+			hash = hashValue(elements[i].inputSlot, hash);
+			hash = hashValue(elements[i].offset, hash);
+			hash = hashValue(elements[i].inputSlotClass, hash);
+			hash = hashValue(elements[i].stepRate, hash);
+		}
+		return hash;
+	}
+
+	static unsigned int hashInputSignature(const std::vector<SignatureParameter>& signature)
+	{
+		unsigned int hash = 2166136261u;
+		for (size_t i = 0; i < signature.size(); i++)
+		{
+			hash = hashString(signature[i].semantic.c_str(), hash);
+			hash = hashValue(signature[i].semanticIndex, hash);
+			hash = hashValue(signature[i].reg, hash);
+			hash = hashValue(signature[i].componentType, hash);
+			hash = hashValue(signature[i].mask, hash);
+		}
+		return hash;
+	}
+
+	// Returns a layout the caller owns one reference to, release it as usual
+	ID3D11InputLayout* get(ID3D11Device* device, const D3D11_INPUT_ELEMENT_DESC* desc, unsigned int count, const void* bytecode, size_t size)
+	{
+		std::vector<ElementKey> elements = readElements(desc, count);
+		std::vector<SignatureParameter> signature = readInputSignature(bytecode, size);
+		std::vector<Entry>& bucket = layouts[std::make_pair(hashElements(elements), hashInputSignature(signature))];
+		for (size_t i = 0; i < bucket.size(); i++)
+		{
+			if (bucket[i].elements == elements && bucket[i].signature == signature)
+			{
+				hits++;
+				bucket[i].layout->AddRef();
+				return bucket[i].layout;
+			}
+		}
+		misses++;
+		ID3D11InputLayout* layout = nullptr;
+		if (FAILED(device->CreateInputLayout(desc, count, bytecode, size, &layout)))
+		{
+			throw std::runtime_error("Failed to create input layout.");
+		}
+		bucket.push_back({ elements, signature, layout });
+		layout->AddRef();
+		return layout;
+	}
+
+	template<typename T>
+	ID3D11InputLayout* get(ID3D11Device* device, const void* bytecode, size_t size)
+	{
+		std::vector<D3D11_INPUT_ELEMENT_DESC> desc;
+		appendInputElements<T>(desc);
+		return get(device, desc.data(), static_cast<unsigned int>(desc.size()), bytecode, size);
+	}
+
+	void release()
+	{
+		for (auto it = layouts.begin(); it != layouts.end(); ++it)
+		{
+			for (size_t i = 0; i < it->second.size(); i++)
+			{
+				it->second[i].layout->Release();
+			}
+		}
+		layouts.clear();
+	}
+
+private:
+	static unsigned int hashString(const char* str, unsigned int hash)
+	{
+		for (; *str != 0; str++)
+		{
+			hash = (hash ^ static_cast<unsigned char>(*str)) * 16777619u;
+		}
+		// Separator so "POS"+"1" and "PO"+"S1" hash differently
+		return (hash ^ 0xFF) * 16777619u;
+	}
+	static unsigned int hashValue(unsigned int value, unsigned int hash)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			hash = (hash ^ ((value >> (i * 8)) & 0xFF)) * 16777619u;
+		}
+		return hash;
+	}
+};